@@ -20,80 +20,347 @@
  * SOFTWARE.
  */
 #include "goap.h"
+#include "goap_domain.h"
 #include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
 #include "cJSON.h"
 
 #define ACTIONLIST_ITER(array) goap_action_t *it = da_begin(array), *end = da_end(array); it != end; ++it
-#define NODELIST_ITER(array) node_t *it = da_begin(array), *end = da_end(array); it != end; ++it
+
+/** marks the root's state record, which has no parent */
+#define NO_RECORD UINT32_MAX
+
+/** a condition on, or change to, a single variable */
+typedef struct {
+    goap_symbol_t symbol;
+    bool value;
+} literal_t;
+
+DA_TYPEDEF(literal_t, literallist_t)
+DA_TYPEDEF(goap_symbol_t, symbollist_t)
+
+/** an action with its name and conditions interned, so the search compares symbols rather than strings */
+typedef struct {
+    const goap_action_t *action;
+    goap_symbol_t name;
+    literallist_t preConditions;
+    literallist_t postConditions;
+    /** the variables the action's checkFunction and costFunction depend on, empty if they depend on all of them */
+    symbollist_t checkVariables;
+    symbollist_t costVariables;
+} interned_action_t;
+
+/**
+ * the world state of a search node, stored as the action that reached it from its parent's state rather than a copy of
+ * the whole map. every GOAP_SNAPSHOT_INTERVAL levels the full state is kept as well, so rebuilding a state never
+ * replays more actions than that. snapshots are persistent world states, so they share everything but the variables
+ * that changed with the state they were forked from
+ */
+typedef struct {
+    /** the action taken from the parent, NULL for the root */
+    const interned_action_t *action;
+    /** index of the parent's record, or NO_RECORD for the root */
+    uint32_t parent;
+    /** index into the snapshots, or NO_RECORD if the state has to be rebuilt from an ancestor's */
+    uint32_t snapshot;
+} state_record_t;
+
+DA_TYPEDEF(state_record_t, recordlist_t)
+DA_TYPEDEF(goap_pworld_t, pworldlist_t)
+DA_TYPEDEF(const interned_action_t*, actionptrlist_t)
+
+/** every state the depth first search has generated */
+typedef struct {
+    recordlist_t records;
+    pworldlist_t snapshots;
+} state_store_t;
 
 /** a node used for graph searching */
 typedef struct {
-    goap_actionlist_t parents;
-    /** current world state at this node (sum of all parents world states, basically) */
-    goap_worldstate_t worldState;
+    /** index of the node's state record, which also links back through the actions that reached it */
+    uint32_t record;
+    /** number of actions taken to reach this node */
+    uint32_t depth;
     /** total cost of this node so far */
     uint32_t cost;
 } node_t;
 
 DA_TYPEDEF(node_t, nodelist_t)
 
-/** returns true if the given action can be executed in the current world state */
-static bool can_perform_action(goap_action_t action, goap_worldstate_t world) {
-    return goap_worldstate_compare(world, action.preConditions);
+/** returns the world state's variables as a list of symbols, which must be freed with da_free() */
+static literallist_t intern_worldstate(const goap_worldstate_t *world) {
+    literallist_t literals = {0};
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(world, &iter))) {
+        literal_t literal = {goap_symbol_intern(key), *goap_worldstate_get(world, key)};
+        da_add(literals, literal);
+    }
+    return literals;
 }
 
-/** updates the specified world state by applying the post conditions of the specified action. works "in place" on world */
-static void execute_action(goap_action_t action, goap_worldstate_t *world) {
+/** returns the symbols of a set of variables, which must be freed with da_free() */
+static symbollist_t intern_variables(const map_bool_t *variables) {
+    symbollist_t symbols = {0};
     map_iter_t iter = map_iter();
     const char *key = NULL;
+    while ((key = map_next(variables, &iter))) {
+        da_add(symbols, goap_symbol_intern(key));
+    }
+    return symbols;
+}
+
+/** returns true if every literal holds in the world state, with unset variables matching neither value */
+static bool literals_hold(const literallist_t *literals, const goap_pworld_t *world) {
+    for (size_t i = 0; i < da_count(*literals); i++) {
+        const bool *value = goap_pworld_get_symbol(world, literals->p[i].symbol);
+        if (value == NULL || *value != literals->p[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** returns true if the given action can be executed in the current world state */
+static bool can_perform_action(const interned_action_t *action, const goap_pworld_t *world) {
+    return literals_hold(&action->preConditions, world);
+}
+
+/** updates the specified world state by applying the post conditions of the specified action, in place */
+static void execute_action(const interned_action_t *action, goap_pworld_t *world) {
     // let's pretend we executed the action, so apply our post-conditions to the backup world
-    while ((key = map_next(&action.postConditions, &iter))) {
-        bool *postResult = map_get(&action.postConditions, key);
-        map_set(world, key, *postResult);
+    for (size_t i = 0; i < da_count(action->postConditions); i++) {
+        goap_pworld_set_symbol(world, action->postConditions.p[i].symbol, action->postConditions.p[i].value);
+    }
+}
+
+/** adds a record for the state reached by taking action from the parent's state, taking ownership of the snapshot */
+static uint32_t store_add(state_store_t *store, uint32_t parent, const interned_action_t *action,
+                          goap_pworld_t *snapshot) {
+    state_record_t record = {action, parent, NO_RECORD};
+    if (snapshot != NULL) {
+        record.snapshot = da_count(store->snapshots);
+        da_add(store->snapshots, *snapshot);
+    }
+    da_add(store->records, record);
+    return da_count(store->records) - 1;
+}
+
+/** rebuilds the world state of a record from the closest snapshot, the caller must free it */
+static goap_pworld_t store_state(const state_store_t *store, uint32_t index) {
+    const interned_action_t *replay[GOAP_SNAPSHOT_INTERVAL];
+    uint32_t count = 0;
+    while (store->records.p[index].snapshot == NO_RECORD) {
+        replay[count++] = store->records.p[index].action;
+        index = store->records.p[index].parent;
+    }
+    goap_pworld_t world = goap_pworld_clone(&store->snapshots.p[store->records.p[index].snapshot]);
+    while (count > 0) {
+        execute_action(replay[--count], &world);
+    }
+    return world;
+}
+
+/** returns the actions taken to reach the record, in order */
+static goap_actionlist_t store_path(const state_store_t *store, uint32_t index, uint32_t depth) {
+    goap_actionlist_t path = {0};
+    if (depth == 0) {
+        return path;
+    }
+    da_addn_uninit(path, depth);
+    for (; depth > 0; index = store->records.p[index].parent) {
+        path.p[--depth] = *store->records.p[index].action->action;
+    }
+    return path;
+}
+
+static void interned_free(interned_action_t *actions, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        da_free(actions[i].preConditions);
+        da_free(actions[i].postConditions);
+        da_free(actions[i].checkVariables);
+        da_free(actions[i].costVariables);
     }
+    free(actions);
 }
 
-/** checks if the given action list contains an entry with the name of "name" */
-static bool contains_name(char *name, goap_actionlist_t history) {
-    for (ACTIONLIST_ITER(history)) {
-        if (strcmp(it->name, name) == 0) {
+static void store_free(state_store_t *store) {
+    for (size_t i = 0; i < da_count(store->snapshots); i++) {
+        goap_pworld_free(&store->snapshots.p[i]);
+    }
+    da_free(store->snapshots);
+    da_free(store->records);
+}
+
+/** checks if an action with the name of "name" was taken on the way to the record */
+static bool contains_name(goap_symbol_t name, const state_store_t *store, uint32_t index) {
+    for (; index != NO_RECORD; index = store->records.p[index].parent) {
+        const interned_action_t *action = store->records.p[index].action;
+        if (action != NULL && action->name == name) {
             return true;
         }
     }
     return false;
 }
 
+/** mixed into the callback cache's hashes so that an action's check and cost results land apart */
+#define CHECK_SALT 0xbf58476d1ce4e5b9ULL
+#define COST_SALT 0xc2b2ae3d27d4eb4fULL
+
+/** mixes a variable's symbol and its value, or the fact that it isn't set, into a hash */
+static inline uint64_t variable_hash(goap_symbol_t symbol, const bool *value) {
+    uint64_t hash = ((uint64_t) symbol << 2 | (value == NULL ? 0 : *value ? 1 : 2)) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * makes the cache key for one of an action's callbacks in the world state: the action, which callback it is, and the
+ * values of the variables the callback depends on (or all of them, if variables is empty). salt tells the action's
+ * callbacks apart. Returns the key's hash
+ */
+static uint64_t callback_key(goap_check_cache_t *checks, const symbollist_t *variables, uint32_t index, uint64_t salt,
+                             const goap_pworld_t *world) {
+    uint64_t callback = (uint64_t) index << 1 | (salt == COST_SALT);
+    // a sum, so it doesn't matter which order the variables are visited in
+    uint64_t hash = (index + 1) * salt;
+    uint8_t *key;
+    if (da_count(*variables) > 0) {
+        // the action fixes which variables these are, so each one only needs its value: unset, false or true
+        key = goap_check_key(checks, sizeof(uint64_t) + da_count(*variables));
+        for (size_t i = 0; i < da_count(*variables); i++) {
+            const bool *value = goap_pworld_get_symbol(world, variables->p[i]);
+            key[sizeof(uint64_t) + i] = value == NULL ? 0 : *value ? 2 : 1;
+            hash += variable_hash(variables->p[i], value);
+        }
+    } else {
+        // the trie's layout only depends on which symbols it holds, so equal states are visited in the same order
+        key = goap_check_key(checks, sizeof(uint64_t) * (1 + world->count));
+        goap_pworld_iter_t iter = goap_pworld_iter(world);
+        for (size_t i = 1; goap_pworld_next(world, &iter); i++) {
+            uint64_t literal = (uint64_t) iter.symbol << 1 | *iter.value;
+            memcpy(key + sizeof(uint64_t) * i, &literal, sizeof(uint64_t));
+            hash += variable_hash(iter.symbol, iter.value);
+        }
+    }
+    memcpy(key, &callback, sizeof(uint64_t));
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/** returns the variables a callback asked for as a world state, which must be freed with map_deinit() */
+static goap_worldstate_t callback_world(const symbollist_t *variables, const goap_pworld_t *world) {
+    goap_worldstate_t view = {0};
+    if (da_count(*variables) > 0) {
+        for (size_t i = 0; i < da_count(*variables); i++) {
+            const bool *value = goap_pworld_get_symbol(world, variables->p[i]);
+            if (value != NULL) {
+                map_set(&view, goap_symbol_name(variables->p[i]), *value);
+            }
+        }
+    } else {
+        goap_pworld_iter_t iter = goap_pworld_iter(world);
+        const char *name = NULL;
+        while ((name = goap_pworld_next(world, &iter))) {
+            map_set(&view, name, *iter.value);
+        }
+    }
+    return view;
+}
+
+/** runs the action's procedural precondition, unless it has already seen the same values of its checkVariables */
+static bool run_check(goap_check_cache_t *checks, const interned_action_t *action, uint32_t index,
+                      const goap_pworld_t *world) {
+    uint64_t hash = callback_key(checks, &action->checkVariables, index, CHECK_SALT, world);
+    uint32_t result;
+    if (goap_check_lookup(checks, hash, &result)) {
+        return result;
+    }
+    goap_worldstate_t view = callback_world(&action->checkVariables, world);
+    result = action->action->checkFunction(action->action, &view);
+    map_deinit(&view);
+    goap_check_store(checks, hash, result);
+    return result;
+}
+
+/** returns the cost of performing the action in the world state, only calling its costFunction for new situations */
+static uint32_t run_cost(goap_check_cache_t *checks, const interned_action_t *action, uint32_t index,
+                         const goap_pworld_t *world) {
+    if (!goap_cost_needed(checks, index)) {
+        return action->action->cost;
+    }
+    uint64_t hash = callback_key(checks, &action->costVariables, index, COST_SALT, world);
+    uint32_t result;
+    if (goap_check_lookup(checks, hash, &result)) {
+        return result;
+    }
+    goap_worldstate_t view = callback_world(&action->costVariables, world);
+    result = action->action->costFunction(action->action, &view);
+    map_deinit(&view);
+    // same as goap_check_cost(), the static cost is what the heuristics think the least it can be is
+    if (result < action->action->cost) {
+        result = action->action->cost;
+    }
+    goap_check_store(checks, hash, result);
+    return result;
+}
+
 /** returns the list of actions that can be executed from this node given it's parents and current state */
-static goap_actionlist_t find_executable_actions(node_t node, goap_actionlist_t actions) {
-    goap_actionlist_t neighbours = {0};
-    for (ACTIONLIST_ITER(actions)) {
+static actionptrlist_t find_executable_actions(const goap_pworld_t *world, const state_store_t *store,
+                                               uint32_t record, const interned_action_t *actions, size_t count,
+                                               goap_check_cache_t *checks) {
+    actionptrlist_t neighbours = {0};
+    for (size_t i = 0; i < count; i++) {
         // exclude actions that we cannot execute or that are our parents
-        if (can_perform_action(*it, node.worldState) && !contains_name(it->name, node.parents)) {
-            da_add(neighbours, *it);
+        if (!can_perform_action(&actions[i], world) || contains_name(actions[i].name, store, record)) {
+            continue;
         }
+        // only then is it worth running the (possibly slow) procedural check
+        if (goap_check_needed(checks, i) && !run_check(checks, &actions[i], i, world)) {
+            continue;
+        }
+        da_add(neighbours, &actions[i]);
     }
     return neighbours;
 }
 
-/** clones the specified map to a new map w/o freeing the old map */
-static goap_worldstate_t map_clone(goap_worldstate_t oldMap) {
-    goap_worldstate_t newMap = {0};
-    map_iter_t iter = map_iter();
-    const char *key = NULL;
-    while ((key = map_next(&oldMap, &iter))) {
-        bool *val = map_get(&oldMap, key);
-        map_set(&newMap, key, *val);
+/** returns true if the world satisfies the goal once the action's post conditions are applied, without copying it */
+static bool reaches_goal(const goap_pworld_t *world, const interned_action_t *action, const literallist_t *goal) {
+    for (size_t i = 0; i < da_count(*goal); i++) {
+        const bool *value = NULL;
+        for (size_t j = 0; j < da_count(action->postConditions) && value == NULL; j++) {
+            if (action->postConditions.p[j].symbol == goal->p[i].symbol) {
+                value = &action->postConditions.p[j].value;
+            }
+        }
+        if (value == NULL) {
+            value = goap_pworld_get_symbol(world, goal->p[i].symbol);
+        }
+        // same closed world assumption as goap_worldstate_compare()
+        if (value == NULL || *value != goal->p[i].value) {
+            return false;
+        }
     }
-    return newMap;
+    return true;
 }
 
-/** clones the specified list to a new list w/o freeing the old list s*/
-static goap_actionlist_t list_clone(goap_actionlist_t oldList) {
-    goap_actionlist_t newList = {0};
-    for (ACTIONLIST_ITER(oldList)) {
-        da_add(newList, *it);
+/** same as goap_domain_compile_state_v2(), for a persistent world state */
+static goap_cond_t compile_pworld(const goap_domain_t *domain, const goap_pworld_t *world) {
+    goap_cond_t out = {0};
+    goap_pworld_iter_t iter = goap_pworld_iter(world);
+    const char *key = NULL;
+    while ((key = goap_pworld_next(world, &iter))) {
+        int bit = goap_domain_var_index(domain, key);
+        if (bit < 0) {
+            continue;
+        }
+        goap_bits_set(&out.mask, bit);
+        if (*iter.value) {
+            goap_bits_set(&out.value, bit);
+        }
     }
-    return newList;
+    return out;
 }
 
 /** used for sorting */
@@ -103,9 +370,9 @@ static int cost_comparator(const void *a, const void *b){
 
     if (nodeA->cost == nodeB->cost){
         // if tie, choose path length
-        if (da_count(nodeA->parents) == da_count(nodeB->parents)){
+        if (nodeA->depth == nodeB->depth){
             return 0;
-        } else if (da_count(nodeA->parents) > da_count(nodeB->parents)){
+        } else if (nodeA->depth > nodeB->depth){
             return 1;
         } else {
             return -1;
@@ -117,90 +384,212 @@ static int cost_comparator(const void *a, const void *b){
     }
 }
 
-goap_actionlist_t goap_planner_plan(goap_worldstate_t currentWorld, goap_worldstate_t goal, goap_actionlist_t allActions) {
-    printf("GOAP planner working with %zu actions", da_count(allActions));
+/**
+ * returns true if the node should be dropped from the search, either because the heuristic says the goal can't be
+ * reached from it, or because it can't beat the best plan found so far
+ */
+static bool prune_node(goap_heuristic_ctx_t *heuristic, const node_t *node, goap_cond_t state, goap_cond_t goal,
+                       uint32_t bestCost) {
+    uint32_t estimate = goap_heuristic_eval(heuristic, state, goal);
+    return estimate == GOAP_HEURISTIC_INFINITY || (uint64_t) node->cost + estimate > bestCost;
+}
+
+/** the actual search, domain is the compiled form of allActions (or NULL if it's not available) */
+static goap_actionlist_t plan_dfs(const goap_worldstate_t *currentWorld, const goap_worldstate_t *goal,
+                                  const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                  goap_plan_stats_t *stats, const goap_domain_t *domain) {
+    printf("GOAP planner working with %zu actions", da_count(*allActions));
     goap_actionlist_t plan = {0};
+    goap_planner_options_t defaults = {0};
+    if (options == NULL) {
+        options = &defaults;
+    }
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    memset(stats, 0, sizeof(*stats));
+    uint64_t startTime = goap_time_us();
+    // the search is exhaustive unless we cut it short or prune with an inadmissible heuristic
+    bool exhaustive = !options->firstSolution && options->maxDepth == 0
+                      && (options->heuristic == GOAP_HEURISTIC_NONE || options->heuristic == GOAP_HEURISTIC_MAX);
+    stats->suboptimalityBound = exhaustive ? 1.0f : INFINITY;
 
     // check if we're already at the goal for some reason
-    if (goap_worldstate_compare(currentWorld, goal)) {
+    if (goap_worldstate_compare_v2(currentWorld, goal)) {
 #if GOAP_DEBUG
         puts("Goal state is already satisfied, no planning required");
 #endif
+        stats->status = GOAP_PLAN_FOUND;
+        stats->elapsedUs = goap_time_us() - startTime;
         return plan;
     }
 
+    // with a heuristic, we can do a branch and bound search instead of visiting the whole graph
+    bool useHeuristic = options->heuristic != GOAP_HEURISTIC_NONE && domain != NULL;
+    goap_heuristic_ctx_t heuristic = {0};
+    goap_cond_t goalCond = {0};
+    uint32_t bestCost = UINT32_MAX;
+    if (useHeuristic) {
+        goap_cond_t start;
+        if (!goap_domain_compile_query_v2(domain, currentWorld, goal, &start, &goalCond)) {
+#if GOAP_DEBUG
+            fprintf(stderr, "Goal depends on variables no action can change, no plan is possible\n");
+#endif
+            stats->elapsedUs = goap_time_us() - startTime;
+            return plan;
+        }
+        goap_heuristic_init(&heuristic, domain, options->heuristic);
+    }
+
+    // intern everything up front, so the search itself never has to look at a variable's name
+    size_t numActions = da_count(*allActions);
+    interned_action_t *actions = calloc(numActions > 0 ? numActions : 1, sizeof(interned_action_t));
+    for (size_t i = 0; i < numActions; i++) {
+        actions[i].action = &allActions->p[i];
+        actions[i].name = goap_symbol_intern(allActions->p[i].name);
+        actions[i].preConditions = intern_worldstate(&allActions->p[i].preConditions);
+        actions[i].postConditions = intern_worldstate(&allActions->p[i].postConditions);
+        actions[i].checkVariables = intern_variables(&allActions->p[i].checkVariables);
+        actions[i].costVariables = intern_variables(&allActions->p[i].costVariables);
+    }
+    literallist_t goalLiterals = intern_worldstate(goal);
+    goap_check_cache_t checks;
+    goap_check_init(&checks, NULL, allActions, NULL);
+
     // use a depth first search to iterate over the whole graph, in future use A*/Dijkstra
+    state_store_t store = {0};
     nodelist_t stack = {0};
     nodelist_t solutions = {0};
 
-    // add our current state to the stack
+    // add our current state to the stack, as the first snapshot every other state is rebuilt from
+    goap_pworld_t root = goap_pworld_from_worldstate(currentWorld);
     node_t initial = {0};
-    initial.worldState = map_clone(currentWorld);
+    initial.record = store_add(&store, NO_RECORD, NULL, &root);
     da_add(stack, initial);
     uint32_t count = 0;
+    bool finished = false;
+    bool timedOut = false;
 
-    while (da_count(stack) > 0) {
+    while (da_count(stack) > 0 && !finished) {
         printf("\nStack has %zu elements\n", da_count(stack));
         // pop the last element off the stack, we can copy it since we're throwing it away
         node_t node = da_pop(stack);
+        if (useHeuristic && node.cost >= bestCost) {
+            // a cheaper plan was found since this node was pushed
+            continue;
+        }
         count++;
+        if (goap_deadline_passed(options, count)) {
+            timedOut = stats->timedOut = true;
+            break;
+        }
+        // forking the snapshot is free, only the variables the replayed actions change are copied
+        goap_pworld_t world = store_state(&store, node.record);
 
         // (just debug stuff)
-        printf("Visiting node with %zu parents\n", da_count(node.parents));
-        if (da_count(node.parents) > 0) {
+        printf("Visiting node with %u parents\n", node.depth);
+        if (node.depth > 0) {
             printf("Parents are:\n");
-            goap_actionlist_dump(node.parents);
+            goap_actionlist_t parents = store_path(&store, node.record, node.depth);
+            goap_actionlist_dump(parents);
+            da_free(parents);
         }
         printf("World state of this node is:\n");
-        goap_worldstate_dump(node.worldState);
+        goap_pworld_dump(&world);
 
         // let's see what actions we can execute in the current world state of the node
-        goap_actionlist_t neighbours = find_executable_actions(node, allActions);
+        actionptrlist_t neighbours = find_executable_actions(&world, &store, node.record, actions, numActions,
+                                                           &checks);
         printf("List of actions we can perform from this state:\n");
-        goap_actionlist_dump(neighbours);
+        if (da_count(neighbours) == 0) {
+            printf("\t(empty action list)\n");
+        }
+        for (size_t i = 0; i < da_count(neighbours); i++) {
+            printf("\t%zu. %s\n", i + 1, neighbours.p[i]->action->name);
+        }
+        goap_cond_t nodeState = {0};
+        if (useHeuristic) {
+            nodeState = compile_pworld(domain, &world);
+        }
 
         // iterate through each action and put a new node on the search list
-        for (ACTIONLIST_ITER(neighbours)) {
-            // clone map (so we don't cause annoying heap use after free problems) and pretend we executed the action
-            goap_worldstate_t newWorld = map_clone(node.worldState);
-            execute_action(*it, &newWorld);
-            printf("After performing %s, new world state is:\n", it->name);
-            goap_worldstate_dump(newWorld);
-
-            // clone the list as well and add the considered neighbour to it
-            goap_actionlist_t parentsClone = list_clone(node.parents);
-            da_add(parentsClone, *it);
+        for (size_t i = 0; i < da_count(neighbours); i++) {
+            const interned_action_t *action = neighbours.p[i];
+            printf("After performing %s, the world state changes by:\n", action->action->name);
+            goap_worldstate_dump(action->action->postConditions);
 
             // make a new node with the updated data
             node_t newNode = {0};
-            newNode.parents = parentsClone;
-            newNode.worldState = newWorld;
-            newNode.cost = node.cost + it->cost;
+            newNode.depth = node.depth + 1;
+            newNode.cost = node.cost + run_cost(&checks, action, action - actions, &world);
 
             // decide which list we add our node to
-            if (goap_worldstate_compare(newWorld, goal)) {
+            if (reaches_goal(&world, action, &goalLiterals)) {
                 printf("Reached goal! Adding to solutions list\n");
+                // solutions are never expanded, so they only need the path
+                newNode.record = store_add(&store, node.record, action, NULL);
                 da_add(solutions, newNode);
-            } else {
-                printf("Added new node with %zu parents to stack\n", da_count(newNode.parents));
-                da_add(stack, newNode);
+                if (newNode.cost < bestCost) {
+                    bestCost = newNode.cost;
+                }
+                if (options->firstSolution) {
+                    // the caller is happy with any plan, so there's no point looking any further
+                    finished = true;
+                    break;
+                }
+                continue;
+            }
+            bool prune = options->maxDepth > 0 && newNode.depth >= options->maxDepth;
+            if (!prune && useHeuristic) {
+                goap_cond_t effect = goap_domain_compile_state_v2(domain, &action->action->postConditions);
+                prune = prune_node(&heuristic, &newNode, goap_cond_apply(nodeState, effect), goalCond, bestCost);
+            }
+            if (prune) {
+                // too deep, hopeless or too expensive to be worth expanding, so drop it
+                continue;
+            }
+            goap_pworld_t snapshot, *snapshotPtr = NULL;
+            if (newNode.depth % GOAP_SNAPSHOT_INTERVAL == 0) {
+                snapshot = goap_pworld_clone(&world);
+                execute_action(action, &snapshot);
+                snapshotPtr = &snapshot;
             }
+            newNode.record = store_add(&store, node.record, action, snapshotPtr);
+            printf("Added new node with %u parents to stack\n", newNode.depth);
+            da_add(stack, newNode);
         }
 
         // free the node's contents now that we no longer need it
-        map_deinit(&node.worldState);
-        da_free(node.parents);
+        goap_pworld_free(&world);
         da_free(neighbours);
     }
     printf("Search is complete. Visited %u nodes, found %zu solutions\n\n", count, da_count(solutions));
+    stats->nodesVisited = count;
+    stats->solutionsFound = da_count(solutions);
+
+    if (useHeuristic) {
+        goap_heuristic_free(&heuristic);
+    }
+
+    if (timedOut) {
+        // there may be cheaper plans we never got to
+        stats->suboptimalityBound = INFINITY;
+    }
 
     // check for no solutions
     if (da_count(solutions) == 0){
 #if GOAP_DEBUG
         fprintf(stderr, "No solutions found in search!");
 #endif
+        stats->status = timedOut ? GOAP_PLAN_BUDGET_EXCEEDED : GOAP_PLAN_NOT_FOUND;
+        store_free(&store);
+        interned_free(actions, numActions);
+        goap_check_free(&checks);
+        da_free(goalLiterals);
         da_free(solutions);
         da_free(stack);
+        stats->elapsedUs = goap_time_us() - startTime;
         return plan;
     }
 
@@ -208,28 +597,632 @@ goap_actionlist_t goap_planner_plan(goap_worldstate_t currentWorld, goap_worldst
     da_sort(solutions, cost_comparator);
     node_t bestSolution = da_get(solutions, 0);
 #if GOAP_DEBUG
-    printf("Best solution: cost %u, length %zu:\n", bestSolution.cost, da_count(bestSolution.parents));
+    printf("Best solution: cost %u, length %u:\n", bestSolution.cost, bestSolution.depth);
 #endif
-    goap_actionlist_dump(bestSolution.parents);
 
-    // add the solution to the output array
-    for (ACTIONLIST_ITER(bestSolution.parents)){
-        da_add(plan, *it);
-    }
+    // the solution's path is the output array
+    plan = store_path(&store, bestSolution.record, bestSolution.depth);
+    goap_actionlist_dump(plan);
 
     // free up all resources we allocated
-    for (NODELIST_ITER(solutions)){
-        map_deinit(&it->worldState);
-        da_free(it->parents);
-    }
+    store_free(&store);
+    interned_free(actions, numActions);
+    goap_check_free(&checks);
+    da_free(goalLiterals);
     da_free(solutions);
     da_free(stack);
+    stats->status = GOAP_PLAN_FOUND;
+    stats->planCost = bestSolution.cost;
+    stats->elapsedUs = goap_time_us() - startTime;
+    return plan;
+}
+
+goap_actionlist_t goap_planner_plan(goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                                    goap_actionlist_t allActions) {
+    return goap_planner_plan_v2(&currentWorld, &goal, &allActions, NULL, NULL);
+}
+
+/** plans with one of the best first searches over the compiled domain, which was compiled from allActions */
+static goap_actionlist_t plan_compiled(const goap_worldstate_t *currentWorld, const goap_worldstate_t *goal,
+                                       const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats, const goap_domain_t *domain) {
+    goap_actionlist_t plan = {0};
+    goap_cond_t start, goalCond;
+    // the search needs the actions themselves to run their procedural checks
+    goap_planner_options_t searchOptions = *options;
+    if (searchOptions.actions == NULL) {
+        searchOptions.actions = allActions;
+    }
+    if (searchOptions.startWorld == NULL) {
+        searchOptions.startWorld = currentWorld;
+    }
+    options = &searchOptions;
+    if (!goap_domain_compile_query_v2(domain, currentWorld, goal, &start, &goalCond)) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Goal depends on variables no action can change, no plan is possible\n");
+#endif
+        memset(stats, 0, sizeof(*stats));
+        return plan;
+    }
+
+    // most plans are short, so they go in a stack buffer, and the search only goes to the heap for really long ones
+    uint32_t buffer[64];
+    size_t length = 0;
+    uint32_t *overflow = NULL;
+    goap_dnf_t dnf = {&goalCond, 1};
+    goap_plan_status_t status = goap_domain_plan_dnf_ex(domain, start, dnf, options, stats, buffer, 64, &length,
+                                                        &overflow);
+    const uint32_t *indices = overflow != NULL ? overflow : buffer;
+    if (status == GOAP_PLAN_FOUND) {
+        for (size_t i = 0; i < length; i++) {
+            da_add(plan, da_get(*allActions, indices[i]));
+        }
+#if GOAP_DEBUG
+        printf("Best solution: cost %u, length %zu:\n", stats->planCost, length);
+        goap_actionlist_dump(plan);
+#endif
+    }
+    free(overflow);
+    return plan;
+}
+
+/** picks the right search for the options, domain may be NULL if allActions couldn't be compiled */
+static goap_actionlist_t plan_dispatch(const goap_worldstate_t *currentWorld, const goap_worldstate_t *goal,
+                                       const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats, const goap_domain_t *domain) {
+    if (options == NULL || options->search == GOAP_SEARCH_DFS) {
+        return plan_dfs(currentWorld, goal, allActions, options, stats, domain);
+    }
+    if (domain == NULL) {
+        // too many variables for the compiled domain, so the only thing we can do is the slow search
+#if GOAP_DEBUG
+        fprintf(stderr, "Actions could not be compiled, falling back to depth first search\n");
+#endif
+        goap_planner_options_t fallback = *options;
+        fallback.search = GOAP_SEARCH_DFS;
+        fallback.heuristic = GOAP_HEURISTIC_NONE;
+        return plan_dfs(currentWorld, goal, allActions, &fallback, stats, NULL);
+    }
+#if GOAP_STATIC
+    for (size_t i = 0; i < da_count(*allActions); i++) {
+        if (allActions->p[i].checkFunction != NULL || allActions->p[i].costFunction != NULL) {
+            // the compiled searches can't cache callback results without the heap, so they don't run them at all
+            goap_planner_options_t fallback = *options;
+            fallback.search = GOAP_SEARCH_DFS;
+            fallback.heuristic = GOAP_HEURISTIC_NONE;
+            return plan_dfs(currentWorld, goal, allActions, &fallback, stats, NULL);
+        }
+    }
+#endif
+    goap_plan_stats_t dummyStats;
+    return plan_compiled(currentWorld, goal, allActions, options, stats != NULL ? stats : &dummyStats, domain);
+}
+
+goap_actionlist_t goap_planner_plan_ex(goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                                       goap_actionlist_t allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats) {
+    return goap_planner_plan_v2(&currentWorld, &goal, &allActions, options, stats);
+}
+
+/**
+ * returns the actions the top-level search may use: allActions itself, or if some of them are only for use inside
+ * compound actions, shallow copies of the rest in topLevel
+ */
+static const goap_actionlist_t *top_level_actions(const goap_actionlist_t *allActions, goap_actionlist_t *topLevel) {
+    size_t first = 0;
+    while (first < da_count(*allActions) && !allActions->p[first].internal) {
+        first++;
+    }
+    if (first == da_count(*allActions)) {
+        return allActions;
+    }
+    da_addn(*topLevel, allActions->p, first);
+    for (size_t i = first + 1; i < da_count(*allActions); i++) {
+        if (!allActions->p[i].internal) {
+            da_add(*topLevel, allActions->p[i]);
+        }
+    }
+    return topLevel;
+}
+
+/** replaces each of the macros in the plan with its steps, which are looked up in allActions */
+static goap_actionlist_t expand_macros(goap_actionlist_t plan, const goap_actionlist_t *macros,
+                                       const goap_actionlist_t *allActions) {
+    goap_actionlist_t expanded = {0};
+    for (size_t i = 0; i < da_count(plan); i++) {
+        // the plan holds copies of the macros, which still point at the same name
+        const goap_action_t *macro = NULL;
+        for (size_t j = 0; j < da_count(*macros) && macro == NULL; j++) {
+            macro = plan.p[i].name == macros->p[j].name ? &macros->p[j] : NULL;
+        }
+        if (macro == NULL) {
+            da_add(expanded, plan.p[i]);
+            continue;
+        }
+        for (size_t j = 0; j < da_count(macro->subActions); j++) {
+            da_add(expanded, *goap_actionlist_find(allActions, macro->subActions.p[j]));
+        }
+    }
+    da_free(plan);
+    return expanded;
+}
+
+goap_actionlist_t goap_planner_plan_v2(const goap_worldstate_t *currentWorld, const goap_worldstate_t *goal,
+                                       const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats) {
+    goap_actionlist_t topLevel = {0}, macros = {0};
+    const goap_actionlist_t *searched = top_level_actions(allActions, &topLevel);
+    goap_macro_learner_t *learner = options != NULL ? options->learner : NULL;
+    bool dfs = options == NULL || (options->search == GOAP_SEARCH_DFS && options->heuristic == GOAP_HEURISTIC_NONE);
+    // the depth first search tries every plan that doesn't repeat an action, so macros would only add to its work
+    if (learner != NULL && !dfs) {
+        macros = goap_macro_learner_macros(learner, allActions);
+        if (da_count(macros) > 0) {
+            if (searched == allActions) {
+                da_addn(topLevel, allActions->p, da_count(*allActions));
+            }
+            da_addn(topLevel, macros.p, da_count(macros));
+            searched = &topLevel;
+        }
+    }
+
+    goap_actionlist_t plan;
+    if (dfs) {
+        plan = plan_dfs(currentWorld, goal, searched, options, stats, NULL);
+    } else {
+        // everything else needs a compiled domain, which we don't have cached here
+        goap_domain_t domain;
+        bool compiled = goap_domain_compile(&domain, *searched);
+        plan = plan_dispatch(currentWorld, goal, searched, options, stats, compiled ? &domain : NULL);
+        if (compiled) {
+            goap_domain_free(&domain);
+        }
+    }
+    if (learner != NULL) {
+        plan = expand_macros(plan, &macros, allActions);
+        if (da_count(plan) > 0) {
+            goap_macro_learner_record(learner, &plan, allActions);
+        }
+    }
+    da_free(topLevel);
+    goap_actionlist_free(&macros);
+    return plan;
+}
+
+/** bits used in the needed literal map, since a variable may be needed as true, false or both */
+#define NEED_TRUE 1
+#define NEED_FALSE 2
+
+/** adds all the key/value pairs of conditions to the needed literal map, returns true if anything was new */
+static bool need_literals(map_int_t *needed, const map_bool_t *conditions) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    bool changed = false;
+    while ((key = map_next(conditions, &iter))) {
+        int bit = *goap_worldstate_get(conditions, key) ? NEED_TRUE : NEED_FALSE;
+        int *flags = map_get(needed, key);
+        int old = flags != NULL ? *flags : 0;
+        if ((old & bit) == 0) {
+            map_set(needed, key, old | bit);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * marks the variables a callback reads as needed with both values, since changing them either way can change what it
+ * returns. returns false if the callback reads the whole world state, so nothing can be ruled out.
+ */
+static bool need_variables(map_int_t *needed, const map_bool_t *variables) {
+    if (variables->base.nnodes == 0) {
+        return false;
+    }
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(variables, &iter))) {
+        map_set(needed, key, NEED_TRUE | NEED_FALSE);
+    }
+    return true;
+}
+
+/** returns true if any of the action's post conditions produce a needed literal */
+static bool achieves_needed(map_int_t *needed, const goap_action_t *action) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(&action->postConditions, &iter))) {
+        int *flags = map_get(needed, key);
+        int bit = *goap_worldstate_get(&action->postConditions, key) ? NEED_TRUE : NEED_FALSE;
+        if (flags != NULL && (*flags & bit)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void goap_relevance_compute(goap_actionlist_t allActions, goap_worldstate_t goal, goap_relevance_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->goal = goap_worldstate_clone(goal);
+    out->goalHash = goap_worldstate_hash(goal);
+
+    map_int_t needed = {0};
+    need_literals(&needed, &goal);
+    bool *relevant = calloc(da_count(allActions) + 1, sizeof(bool));
+
+    // chain backwards from the goal until nothing new becomes relevant. each pass can only add actions, so this
+    // terminates after at most one pass per action
+    bool changed = true;
+    bool everything = false;
+    while (changed && !everything) {
+        changed = false;
+        for (size_t i = 0; i < da_count(allActions); i++) {
+            goap_action_t *action = da_getptr(allActions, i);
+            if (!relevant[i] && !action->internal && achieves_needed(&needed, action)) {
+                relevant[i] = true;
+                need_literals(&needed, &action->preConditions);
+                if (action->checkFunction != NULL && !need_variables(&needed, &action->checkVariables)) {
+                    everything = true;
+                }
+                // an action that changes what a cost depends on can make the plan cheaper
+                if (action->costFunction != NULL && !need_variables(&needed, &action->costVariables)) {
+                    everything = true;
+                }
+                changed = true;
+            }
+        }
+    }
+    if (everything) {
+        // a relevant action's check or cost reads the whole world state, so any action could matter to it
+        for (size_t i = 0; i < da_count(allActions); i++) {
+            goap_action_t *action = da_getptr(allActions, i);
+            if (!action->internal) {
+                relevant[i] = true;
+                need_literals(&needed, &action->preConditions);
+            }
+        }
+    }
+
+    // keep the original order of the actions, the planner's tie breaking depends on it
+    out->indices = malloc(sizeof(uint32_t) * (da_count(allActions) + 1));
+    for (size_t i = 0; i < da_count(allActions); i++) {
+        if (relevant[i]) {
+            out->indices[da_count(out->actions)] = i;
+            da_add(out->actions, da_get(allActions, i));
+        }
+    }
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(&needed, &iter))) {
+        map_set(&out->variables, key, true);
+    }
+    out->domain = malloc(sizeof(goap_domain_t));
+    if (!goap_domain_compile(out->domain, out->actions)) {
+        free(out->domain);
+        out->domain = NULL;
+    }
+#if GOAP_DEBUG
+    printf("Relevance analysis kept %zu of %zu actions\n", da_count(out->actions), da_count(allActions));
+#endif
+    free(relevant);
+    map_deinit(&needed);
+}
+
+void goap_relevance_free(goap_relevance_t *relevance) {
+    if (relevance->domain != NULL) {
+        goap_domain_free(relevance->domain);
+        free(relevance->domain);
+    }
+    map_deinit(&relevance->goal);
+    map_deinit(&relevance->variables);
+    da_free(relevance->actions);
+    free(relevance->indices);
+}
+
+/** creates a version holding one reference, for the library that publishes it */
+static goap_library_version_t *version_create(goap_actionlist_t actions, uint64_t generation) {
+    goap_library_version_t *version = calloc(1, sizeof(*version));
+    version->actions = actions;
+    version->generation = generation;
+    pthread_mutex_init(&version->lock, NULL);
+    atomic_init(&version->refs, 1);
+    // compile now rather than on first use, so a reload does the expensive work before it's published
+    version->domain = malloc(sizeof(goap_domain_t));
+    if (!goap_domain_compile(version->domain, actions)) {
+        free(version->domain);
+        version->domain = NULL;
+    }
+    return version;
+}
+
+static void version_free(goap_library_version_t *version) {
+#if GOAP_DEBUG
+    printf("Freeing library generation %llu\n", (unsigned long long) version->generation);
+#endif
+    for (size_t i = 0; i < da_count(version->relevance); i++) {
+        goap_relevance_t *relevance = da_get(version->relevance, i);
+        goap_relevance_free(relevance);
+        free(relevance);
+    }
+    da_free(version->relevance);
+    if (version->domain != NULL) {
+        goap_domain_free(version->domain);
+        free(version->domain);
+    }
+    goap_actionlist_free(&version->actions);
+    pthread_mutex_destroy(&version->lock);
+    free(version);
+}
+
+void goap_library_init(goap_library_t *library, goap_actionlist_t actions) {
+    memset(library, 0, sizeof(*library));
+    atomic_init(&library->current, version_create(actions, 1));
+    atomic_init(&library->generation, 1);
+    atomic_init(&library->acquiring[0], 0);
+    atomic_init(&library->acquiring[1], 0);
+    pthread_mutex_init(&library->reloadLock, NULL);
+}
+
+void goap_library_free(goap_library_t *library) {
+    goap_library_release(atomic_load(&library->current));
+    pthread_mutex_destroy(&library->reloadLock);
+}
+
+uint64_t goap_library_reload(goap_library_t *library, goap_actionlist_t actions) {
+    pthread_mutex_lock(&library->reloadLock);
+    uint64_t generation = atomic_load(&library->generation) + 1;
+    goap_library_version_t *version = version_create(actions, generation);
+    goap_library_version_t *old = atomic_exchange(&library->current, version);
+    atomic_store(&library->generation, generation);
+    // a reader that loaded the old pointer just before the exchange may not have taken its reference yet, and
+    // dropping ours first could free the version under it. any such reader saw the old generation and is counted
+    // under its parity. anyone who starts acquiring from here on is counted under the other one, so however many
+    // threads keep acquiring, this only waits out the few instructions the stragglers have left.
+    atomic_uint *stragglers = &library->acquiring[(generation - 1) & 1];
+    while (atomic_load(stragglers) != 0) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&library->reloadLock);
+    goap_library_release(old);
+    return generation;
+}
+
+uint64_t goap_library_generation(goap_library_t *library) {
+    return atomic_load(&library->generation);
+}
+
+goap_library_version_t *goap_library_acquire(goap_library_t *library) {
+    while (true) {
+        uint64_t generation = atomic_load(&library->generation);
+        atomic_uint *acquiring = &library->acquiring[generation & 1];
+        atomic_fetch_add(acquiring, 1);
+        // if a reload bumped the generation before we were counted, it may not be waiting for us, so start again
+        if (atomic_load(&library->generation) != generation) {
+            atomic_fetch_sub(acquiring, 1);
+            continue;
+        }
+        goap_library_version_t *version = atomic_load(&library->current);
+        atomic_fetch_add(&version->refs, 1);
+        atomic_fetch_sub(acquiring, 1);
+        return version;
+    }
+}
+
+void goap_library_retain(goap_library_version_t *version) {
+    atomic_fetch_add(&version->refs, 1);
+}
+
+void goap_library_release(goap_library_version_t *version) {
+    if (atomic_fetch_sub(&version->refs, 1) == 1) {
+        version_free(version);
+    }
+}
+
+/** finds the cached relevance analysis for the goal, the version must be locked */
+static goap_relevance_t *find_relevance(goap_library_version_t *version, const goap_worldstate_t *goal,
+                                        uint64_t goalHash) {
+    for (size_t i = 0; i < da_count(version->relevance); i++) {
+        goap_relevance_t *relevance = da_get(version->relevance, i);
+        if (relevance->goalHash == goalHash && relevance->goal.base.nnodes == goal->base.nnodes
+            && goap_worldstate_compare_v2(&relevance->goal, goal)) {
+            return relevance;
+        }
+    }
+    return NULL;
+}
+
+const goap_relevance_t *goap_library_relevance(goap_library_version_t *version, goap_worldstate_t goal) {
+    return goap_library_relevance_v2(version, &goal);
+}
+
+const goap_relevance_t *goap_library_relevance_v2(goap_library_version_t *version, const goap_worldstate_t *goal) {
+    uint64_t goalHash = goap_worldstate_hash_v2(goal);
+    pthread_mutex_lock(&version->lock);
+    goap_relevance_t *relevance = find_relevance(version, goal, goalHash);
+    pthread_mutex_unlock(&version->lock);
+    if (relevance != NULL) {
+        return relevance;
+    }
+
+    // compute without holding the lock, so other threads aren't held up. if someone beat us to it, use theirs
+    goap_relevance_t *computed = malloc(sizeof(*computed));
+    goap_relevance_compute(version->actions, *goal, computed);
+    pthread_mutex_lock(&version->lock);
+    relevance = find_relevance(version, goal, goalHash);
+    if (relevance == NULL) {
+        da_add(version->relevance, computed);
+        relevance = computed;
+        computed = NULL;
+    }
+    pthread_mutex_unlock(&version->lock);
+    if (computed != NULL) {
+        goap_relevance_free(computed);
+        free(computed);
+    }
+    return relevance;
+}
+
+goap_actionlist_t goap_library_plan(goap_library_version_t *version, goap_worldstate_t currentWorld,
+                                    goap_worldstate_t goal, const goap_planner_options_t *options,
+                                    goap_plan_stats_t *stats) {
+    return goap_library_plan_v2(version, &currentWorld, &goal, options, stats);
+}
+
+goap_actionlist_t goap_library_plan_v2(goap_library_version_t *version, const goap_worldstate_t *currentWorld,
+                                       const goap_worldstate_t *goal, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats) {
+    const goap_relevance_t *relevance = goap_library_relevance_v2(version, goal);
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    goap_actionlist_t plan = plan_dispatch(currentWorld, goal, &relevance->actions, options, stats,
+                                           relevance->domain);
+    stats->actionsPruned = da_count(version->actions) - da_count(relevance->actions);
+    stats->libraryVersion = version;
     return plan;
 }
 
+goap_plan_status_t goap_library_plan_indices(goap_library_version_t *version, goap_worldstate_t currentWorld,
+                                             goap_worldstate_t goal, const goap_planner_options_t *options,
+                                             goap_plan_stats_t *stats, uint32_t *plan, size_t capacity,
+                                             size_t *length) {
+    return goap_library_plan_indices_v2(version, &currentWorld, &goal, options, stats, plan, capacity, length);
+}
+
+goap_plan_status_t goap_library_plan_indices_v2(goap_library_version_t *version, const goap_worldstate_t *currentWorld,
+                                                const goap_worldstate_t *goal, const goap_planner_options_t *options,
+                                                goap_plan_stats_t *stats, uint32_t *plan, size_t capacity,
+                                                size_t *length) {
+    const goap_relevance_t *relevance = goap_library_relevance_v2(version, goal);
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    memset(stats, 0, sizeof(*stats));
+    *length = 0;
+    goap_cond_t start, goalCond;
+    if (relevance->domain == NULL || !goap_domain_compile_query_v2(relevance->domain, currentWorld, goal, &start,
+                                                                   &goalCond)) {
+        return GOAP_PLAN_NOT_FOUND;
+    }
+    goap_planner_options_t searchOptions = {0};
+    searchOptions.search = GOAP_SEARCH_ASTAR;
+    if (options != NULL) {
+        searchOptions = *options;
+    }
+    if (searchOptions.search == GOAP_SEARCH_DFS) {
+        // there's no depth first search over compiled domains, so say which search actually runs, and the stats
+        // report its bound rather than the depth first search's
+        searchOptions.search = GOAP_SEARCH_ASTAR;
+    }
+    searchOptions.actions = &relevance->actions;
+    searchOptions.startWorld = currentWorld;
+    goap_plan_status_t status = goap_domain_plan(relevance->domain, start, goalCond, &searchOptions, stats, plan,
+                                                 capacity, length);
+    // the search ran over the relevant actions only, translate back to indices into the whole library
+    if (status == GOAP_PLAN_FOUND) {
+        for (size_t i = 0; i < *length; i++) {
+            plan[i] = relevance->indices[plan[i]];
+        }
+    }
+    stats->actionsPruned = da_count(version->actions) - da_count(relevance->actions);
+    stats->libraryVersion = version;
+    return status;
+}
+
+/** how far along working out a sequence's conditions from its steps is */
+enum {
+    SUMMARY_NONE,
+    SUMMARY_PENDING,
+    SUMMARY_VISITING,
+    SUMMARY_DONE
+};
+
+typedef struct {
+    uint8_t state;
+    /** true if the document left out the sequence's conditions, so they're worked out from its steps */
+    bool summarise;
+    /** cost given in the document, which takes the place of the steps' total, or -1 */
+    int64_t cost;
+} summary_t;
+
+DA_TYPEDEF(summary_t, summarylist_t)
+
+/** returns true if the item is a non-empty array of strings */
+static bool json_is_namelist(const cJSON *item) {
+    if (!cJSON_IsArray(item) || cJSON_GetArraySize(item) == 0) {
+        return false;
+    }
+    const cJSON *name = NULL;
+    cJSON_ArrayForEach(name, item) {
+        if (!cJSON_IsString(name)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * checks the sequence at index doesn't contain itself, and works out its conditions if the document left them out,
+ * after those of any of its steps that need it first
+ */
+static bool summarise_sequence(goap_actionlist_t *actions, summarylist_t *summaries, size_t index) {
+    if (summaries->p[index].state == SUMMARY_VISITING) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Invalid JSON document: compound action %s contains itself\n", actions->p[index].name);
+#endif
+        return false;
+    }
+    if (summaries->p[index].state != SUMMARY_PENDING) {
+        return true;
+    }
+    summaries->p[index].state = SUMMARY_VISITING;
+    goap_action_t *action = &actions->p[index];
+    for (size_t i = 0; i < da_count(action->subActions); i++) {
+        goap_action_t *step = goap_actionlist_find(actions, action->subActions.p[i]);
+        if (step != NULL && !summarise_sequence(actions, summaries, step - actions->p)) {
+            return false;
+        }
+    }
+    if (summaries->p[index].summarise && !goap_action_summarise(action, actions)) {
+        return false;
+    }
+    summaries->p[index].state = SUMMARY_DONE;
+    if (summaries->p[index].summarise && summaries->p[index].cost >= 0) {
+        action->cost = summaries->p[index].cost;
+    }
+    return true;
+}
+
+/**
+ * checks every compound action's subActions exist and no sequence contains itself, and works out the conditions of
+ * sequences that left them out
+ */
+static bool resolve_compound_actions(goap_actionlist_t *actions, summarylist_t *summaries) {
+    for (size_t i = 0; i < da_count(*actions); i++) {
+        const goap_action_t *action = &actions->p[i];
+        for (size_t j = 0; j < da_count(action->subActions); j++) {
+            if (goap_actionlist_find(actions, action->subActions.p[j]) == NULL) {
+#if GOAP_DEBUG
+                fprintf(stderr, "Invalid JSON document: compound action %s uses %s, which doesn't exist\n",
+                        action->name, action->subActions.p[j]);
+#endif
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < da_count(*actions); i++) {
+        if (!summarise_sequence(actions, summaries, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 goap_actionlist_t goap_parse_json(char *str, size_t length) {
     cJSON *json = cJSON_ParseWithLength(str, length);
     goap_actionlist_t out = {0};
+    summarylist_t summaries = {0};
     if (json == NULL) {
 #if GOAP_DEBUG
         fprintf(stderr, "Failed to parse JSON document: token %s\n", cJSON_GetErrorPtr());
@@ -251,38 +1244,38 @@ goap_actionlist_t goap_parse_json(char *str, size_t length) {
         cJSON *cost = cJSON_GetObjectItem(action, "cost");
         cJSON *preConditions = cJSON_GetObjectItem(action, "preConditions");
         cJSON *postConditions = cJSON_GetObjectItem(action, "postConditions");
-        char *dump = cJSON_Print(action);
+        cJSON *steps = cJSON_GetObjectItem(action, "steps");
+        cJSON *subActions = cJSON_GetObjectItem(action, "subActions");
+        cJSON *internal = cJSON_GetObjectItem(action, "internal");
+        // a sequence that leaves out its conditions gets them from its steps, along with its cost unless it has one
+        bool summarised = steps != NULL && preConditions == NULL && postConditions == NULL;
 
         // validate our parsed data
+        const char *problem = NULL;
         if (!cJSON_IsString(name)) {
+            problem = "action name is not a string or doesn't exist";
+        } else if (!cJSON_IsNumber(cost) && !(summarised && cost == NULL)) {
+            problem = "action cost is not a number or doesn't exist";
+        } else if (!cJSON_IsObject(preConditions) && !summarised) {
+            problem = "action preConditions is not an object or doesn't exist";
+        } else if (!cJSON_IsObject(postConditions) && !summarised) {
+            problem = "action postConditions is not an object or doesn't exist";
+        } else if (steps != NULL && subActions != NULL) {
+            problem = "action has both steps and subActions";
+        } else if ((steps != NULL && !json_is_namelist(steps))
+                   || (subActions != NULL && !json_is_namelist(subActions))) {
+            problem = "action steps or subActions is not a non-empty array of names";
+        } else if (internal != NULL && !cJSON_IsBool(internal)) {
+            problem = "action internal is not true or false";
+        }
+        if (problem != NULL) {
 #if GOAP_DEBUG
-            fprintf(stderr, "Invalid JSON object: action name is not a string or doesn't exist\n%s", dump);
-#endif
-            free(dump);
-            break;
-        } else if (!cJSON_IsNumber(cost)) {
-#if GOAP_DEBUG
-            fprintf(stderr, "Invalid JSON object: action cost is not a number or doesn't exist\n%s", dump);
-#endif
-            free(dump);
-            break;
-        } else if (!cJSON_IsObject(preConditions)) {
-#if GOAP_DEBUG
-            fprintf(stderr, "Invalid JSON object: action preConditions is not an object or doesn't exist\n%s", dump);
-#endif
+            // only print the offending action, printing every one is surprisingly slow for large documents
+            char *dump = cJSON_Print(action);
+            fprintf(stderr, "Invalid JSON object: %s\n%s", problem, dump);
             free(dump);
-            break;
-        } else if (!cJSON_IsObject(postConditions)) {
-#if GOAP_DEBUG
-            fprintf(stderr, "Invalid JSON object: action postConditions is not an object or doesn't exist\n%s", dump);
 #endif
-            free(dump);
             break;
-        } else {
-#if GOAP_DEBUG
-            puts("Verification passed for config object");
-#endif
-            free(dump);
         }
         // additional requirements that are not checked here:
         // - each action MUST have a unique string name
@@ -291,7 +1284,9 @@ goap_actionlist_t goap_parse_json(char *str, size_t length) {
         goap_action_t parsedAction = {0};
         // because cJSON_Delete() apparently also deletes all the strings we have to strdup() the name
         parsedAction.name = strdup(name->valuestring);
-        parsedAction.cost = cost->valueint;
+        parsedAction.cost = cost != NULL ? cost->valueint : 0;
+        parsedAction.sequence = steps != NULL;
+        parsedAction.internal = cJSON_IsTrue(internal);
         map_init(&parsedAction.preConditions);
         map_init(&parsedAction.postConditions);
 
@@ -304,12 +1299,25 @@ goap_actionlist_t goap_parse_json(char *str, size_t length) {
         cJSON_ArrayForEach(postItem, postConditions) {
             map_set(&parsedAction.postConditions, postItem->string, postItem->valueint);
         }
+        cJSON *body = steps != NULL ? steps : subActions;
+        cJSON *subAction = NULL;
+        cJSON_ArrayForEach(subAction, body) {
+            da_add(parsedAction.subActions, strdup(subAction->valuestring));
+        }
 
         da_add(out, parsedAction);
+        summary_t summary = {steps != NULL ? SUMMARY_PENDING : SUMMARY_NONE, summarised,
+                             cost != NULL ? cost->valueint : -1};
+        da_add(summaries, summary);
+    }
+    // compound actions can refer to actions further down, so they're only checked once everything has been read
+    if (!resolve_compound_actions(&out, &summaries)) {
+        goap_actionlist_free(&out);
     }
 
     finish:
     cJSON_Delete(json);
+    da_free(summaries);
     return out;
 }
 
@@ -319,6 +1327,12 @@ void goap_actionlist_free(goap_actionlist_t *list) {
         free(action.name);
         map_deinit(&action.preConditions);
         map_deinit(&action.postConditions);
+        map_deinit(&action.checkVariables);
+        map_deinit(&action.costVariables);
+        for (size_t j = 0; j < da_count(action.subActions); j++) {
+            free(action.subActions.p[j]);
+        }
+        da_free(action.subActions);
         // action itself is stack allocated (or something like that) so no need to free it
     }
     da_free(*list);
@@ -352,12 +1366,17 @@ void goap_worldstate_dump(goap_worldstate_t world) {
 }
 
 bool goap_worldstate_compare(goap_worldstate_t currentState, goap_worldstate_t goal) {
+    return goap_worldstate_compare_v2(&currentState, &goal);
+}
+
+bool goap_worldstate_compare_v2(const goap_worldstate_t *restrict currentState,
+                                const goap_worldstate_t *restrict goal) {
     map_iter_t iter = map_iter();
     const char *key = NULL;
 
-    while ((key = map_next(&goal, &iter))) {
-        bool *curVal = map_get(&currentState, key);
-        bool *targetVal = map_get(&goal, key);
+    while ((key = map_next(goal, &iter))) {
+        const bool *curVal = goap_worldstate_get(currentState, key);
+        const bool *targetVal = goap_worldstate_get(goal, key);
 
         // interesting to note: STRIPS planners like GOAP make the closed world assumption, which we see on this line.
         // if curVal is NULL, it means that the key from the goal state was not found in the current state.
@@ -367,4 +1386,45 @@ bool goap_worldstate_compare(goap_worldstate_t currentState, goap_worldstate_t g
         }
     }
     return true;
+}
+
+goap_worldstate_t goap_worldstate_clone(goap_worldstate_t world) {
+    return goap_worldstate_clone_v2(&world);
+}
+
+goap_worldstate_t goap_worldstate_clone_v2(const goap_worldstate_t *world) {
+    // the whole map is one block, so this is a single allocation and copy rather than one per variable
+    goap_worldstate_t newMap = {0};
+    map_clone(&newMap, world);
+    return newMap;
+}
+
+uint64_t goap_worldstate_hash(goap_worldstate_t world) {
+    return goap_worldstate_hash_v2(&world);
+}
+
+uint64_t goap_worldstate_hash_v2(const goap_worldstate_t *world) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    uint64_t hash = 0;
+    while ((key = map_next(world, &iter))) {
+        // FNV-1a over the key and its value
+        uint64_t entry = 14695981039346656037ULL;
+        for (const char *c = key; *c; c++) {
+            entry = (entry ^ (uint8_t) *c) * 1099511628211ULL;
+        }
+        entry = (entry ^ (*goap_worldstate_get(world, key) ? 1 : 2)) * 1099511628211ULL;
+        // then a splitmix64 finaliser, so that summing the entries (which is what makes the hash order independent)
+        // doesn't cancel out bits
+        entry = (entry ^ (entry >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        entry = (entry ^ (entry >> 27)) * 0x94d049bb133111ebULL;
+        hash += entry ^ (entry >> 31);
+    }
+    return hash;
+}
+
+uint64_t goap_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
\ No newline at end of file
@@ -22,6 +22,8 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "DG_dynarr.h"
 #include "map.h"
 
@@ -33,11 +35,63 @@
 #define GOAP_VERSION "1.0.0"
 /** If true, prints log statements in GOAP code */
 #define GOAP_DEBUG 1
+/**
+ * If true, the compiled planner (goap_domain_plan()) keeps everything in statically sized arrays, limited by
+ * GOAP_MAX_VARS, GOAP_MAX_ACTIONS and GOAP_MAX_NODES (see goap_domain.h), and never touches the heap. Since the arrays
+ * are shared, only one search may run at a time.
+ */
+#ifndef GOAP_STATIC
+#define GOAP_STATIC 0
+#endif
+/**
+ * Search nodes don't copy the world state, they store the action that reached them from their parent instead. Every
+ * GOAP_SNAPSHOT_INTERVAL levels a full copy is kept as well, so rebuilding a node's state replays at most this many
+ * actions. Lower values use more memory to make that cheaper.
+ */
+#ifndef GOAP_SNAPSHOT_INTERVAL
+#define GOAP_SNAPSHOT_INTERVAL 8
+#endif
+_Static_assert(GOAP_SNAPSHOT_INTERVAL > 0, "GOAP_SNAPSHOT_INTERVAL must be positive");
 
 typedef map_t(bool) map_bool_t;
 /** Used to define the current state of a GOAP world */
 typedef map_bool_t goap_worldstate_t;
 
+/**
+ * An interned variable name, see goap_symbol_intern(). Two symbols are equal exactly when their names are, so they can
+ * be compared without touching the strings.
+ */
+typedef uint32_t goap_symbol_t;
+/** Returned by goap_symbol_find() for a name that was never interned */
+#define GOAP_SYMBOL_NONE UINT32_MAX
+
+/** A node of a goap_pworld_t's trie, see goap_pworld.c */
+typedef struct goap_pworld_node_t goap_pworld_node_t;
+
+/**
+ * A persistent world state, for when states need to be copied a lot. Copies share everything they have in common, so
+ * goap_pworld_clone() is O(1) and an update only copies O(log n) of the state. Nodes are reference counted, so states
+ * can be shared with (and freed on) other threads, as long as each goap_pworld_t is only used by one thread at a time.
+ */
+typedef struct {
+    goap_pworld_node_t *root;
+    /** number of variables that are set */
+    uint32_t count;
+} goap_pworld_t;
+
+/** Deepest a goap_pworld_t's trie can go: one level per 5 bits of a 32 bit hash, and a leaf */
+#define GOAP_PWORLD_MAX_DEPTH 8
+
+/** Iterates over the variables of a goap_pworld_t, see goap_pworld_next() */
+typedef struct {
+    const goap_pworld_node_t *nodes[GOAP_PWORLD_MAX_DEPTH];
+    uint8_t next[GOAP_PWORLD_MAX_DEPTH];
+    uint32_t depth;
+    /** the variable goap_pworld_next() last returned, and its value */
+    goap_symbol_t symbol;
+    const bool *value;
+} goap_pworld_iter_t;
+
 typedef enum {
     /** The action has not yet been completed and is still running */
     GOAP_STATUS_RUNNING = 0,
@@ -47,8 +101,26 @@ typedef enum {
     GOAP_STATUS_FAILED
 } goap_action_status_t;
 
+struct goap_action_t;
+
+/**
+ * A procedural precondition, for things that can't be written as a variable (line of sight, a path existing). Returns
+ * true if the action can be performed in the given world state, which only holds the variables the action's
+ * checkVariables name (or all of them, if it names none).
+ */
+typedef bool (*goap_check_fn)(const struct goap_action_t *action, const goap_worldstate_t *world);
+/**
+ * The cost of performing the action in the given world state, which only holds the variables the action's
+ * costVariables name (or all of them, if it names none).
+ */
+typedef uint32_t (*goap_cost_fn)(const struct goap_action_t *action, const goap_worldstate_t *world);
+
+/** A list of action names, which each own their string */
+DA_TYPEDEF(char*, goap_namelist_t)
+
 typedef struct goap_action_t {
     char *name;
+    /** the action's cost, or if it has a costFunction, the least that can return */
     uint32_t cost;
     /** a hashmap of conditions that must be true for this action to be executed */
     map_bool_t preConditions;
@@ -56,41 +128,529 @@ typedef struct goap_action_t {
     map_bool_t postConditions;
     /** code that is executed while the action is running, returns the status */
     goap_action_status_t (*actionFunction)(void);
+    /**
+     * optional procedural precondition, only called once preConditions hold. Its result is cached for the rest of the
+     * planning call, so it runs once per distinct value of checkVariables rather than once per search node.
+     */
+    goap_check_fn checkFunction;
+    /** the set of variables checkFunction depends on. If empty, it depends on the whole world state. */
+    map_bool_t checkVariables;
+    /**
+     * optional cost that depends on the state the action is performed in, cached the same way as checkFunction. The
+     * heuristics only know about cost, so results below it are raised to it.
+     */
+    goap_cost_fn costFunction;
+    /** the set of variables costFunction depends on. If empty, it depends on the whole world state. */
+    map_bool_t costVariables;
+    /**
+     * for compound actions, the names of the actions it's made of, empty for primitive ones. The planner treats a
+     * compound action like any other, using its own conditions and cost, and it's only expanded into these once it's
+     * about to run, with goap_planner_refine().
+     */
+    goap_namelist_t subActions;
+    /**
+     * if true, subActions run in exactly that order, and goap_action_summarise() can work out the compound action's
+     * conditions and cost from them. Otherwise it's refined by planning for its postConditions using only subActions.
+     */
+    bool sequence;
+    /** if true, the action is only used inside compound actions, so the top-level search never considers it */
+    bool internal;
 } goap_action_t;
 
 /** A linked list of goap_action_t items */
 DA_TYPEDEF(goap_action_t, goap_actionlist_t)
 
 /**
- * Calculates the optimal route of actions to take the agent from the current world state to the goal state.
- * Currently uses Dijkstra's algorithm for pathfinding (in future, A*).
- * If no plan could be created, prints an error and returns an empty list.
+ * Learns macro actions from the plans agents actually carry out: it counts how often each short run of consecutive
+ * actions turns up, and the most frequent runs become compound sequences that the search can take in a single step.
+ * A macro costs exactly what its steps do, so it never changes which plans are cheapest, it just makes them shallower.
+ * Counting and searching are safe from several threads at once, see goap_macro_learner_record().
+ */
+typedef struct {
+    /** how many times each run of actions has been seen, keyed by their names, each followed by a separator */
+    map_int_t counts;
+    /** the macros learned so far */
+    goap_actionlist_t macros;
+    /** most macros to keep, which bounds how much they add to the search's branching */
+    uint32_t maxMacros;
+    /** shortest and longest runs of actions that are counted */
+    uint32_t minLength;
+    uint32_t maxLength;
+    /** runs seen fewer times than this never become macros */
+    uint32_t minCount;
+    /** most runs to keep counts for. Beyond that every count is halved, which forgets the ones only seen once. */
+    uint32_t maxPatterns;
+    /** the macros are worked out again from the counts every this many recorded plans */
+    uint32_t updateInterval;
+    uint64_t plansRecorded;
+    pthread_mutex_t lock;
+} goap_macro_learner_t;
+
+/** Heuristics that estimate the cost remaining to reach the goal, see goap_domain.h */
+typedef enum {
+    /** no estimate */
+    GOAP_HEURISTIC_NONE = 0,
+    /** most expensive single goal variable ignoring delete effects (h_max). Admissible, so plans stay optimal. */
+    GOAP_HEURISTIC_MAX,
+    /** sum of the cost of each goal variable ignoring delete effects (h_add). Not admissible, but better informed. */
+    GOAP_HEURISTIC_ADD,
+    /** cost of a relaxed plan extracted from h_add (h_FF). Not admissible, usually the most accurate. */
+    GOAP_HEURISTIC_FF
+} goap_heuristic_t;
+
+/** Search strategies the planner can use */
+typedef enum {
+    /** exhaustive depth first search over the world state maps, the original planner. Always finds the cheapest plan
+     * that doesn't repeat an action, but visits the whole graph to do it. */
+    GOAP_SEARCH_DFS = 0,
+    /** Dijkstra's algorithm over the compiled domain. Optimal, ignores the heuristic. */
+    GOAP_SEARCH_UNIFORM_COST,
+    /** A* over the compiled domain. Optimal if the heuristic is admissible (none or h_max). */
+    GOAP_SEARCH_ASTAR,
+    /** A* with the heuristic multiplied by weight. With an admissible heuristic, the plan costs at most weight times
+     * the optimal plan, and is usually found much faster. */
+    GOAP_SEARCH_WEIGHTED_ASTAR,
+    /** greedy best first search, which only follows the heuristic. Fastest, with no bound on the plan's cost. */
+    GOAP_SEARCH_GREEDY,
+    /** iterative deepening A* over the compiled domain. Optimal with an admissible heuristic, and runs entirely in
+     * the workspace buffer, which only needs to grow linearly with the plan length. */
+    GOAP_SEARCH_IDASTAR
+} goap_search_t;
+
+/** Outcome of a planning call */
+typedef enum {
+    /** no sequence of actions reaches the goal (or none within the search limits) */
+    GOAP_PLAN_NOT_FOUND = 0,
+    /** a plan was found, or the goal was already satisfied */
+    GOAP_PLAN_FOUND,
+    /** a plan was found, but it didn't fit in the buffer given to goap_domain_plan() */
+    GOAP_PLAN_TOO_LONG,
+    /** the search ran out of the memory or time it was allowed to use before it could find a plan */
+    GOAP_PLAN_BUDGET_EXCEEDED
+} goap_plan_status_t;
+
+/** Tunes a single call to goap_planner_plan_ex(). A zeroed struct gives the default, exhaustive search. */
+typedef struct {
+    /** search strategy to use */
+    goap_search_t search;
+    /** heuristic weight for GOAP_SEARCH_WEIGHTED_ASTAR, values below 1 are treated as 1 */
+    float weight;
+    /** if non-zero, plans longer than this many actions are not considered */
+    uint32_t maxDepth;
+    /** if true, the depth first search returns the first plan it finds instead of the cheapest one */
+    bool firstSolution;
+    /**
+     * heuristic that guides the A* and greedy searches. The depth first search uses it to prune instead: nodes that
+     * can't reach the goal at all, or can't beat the best plan found so far, are dropped. That's exact with
+     * GOAP_HEURISTIC_MAX, the others may miss the cheapest plan.
+     */
+    goap_heuristic_t heuristic;
+    /**
+     * memory for GOAP_SEARCH_IDASTAR to work in, so that it never allocates. See goap_idastar_workspace_size() for how
+     * big it needs to be. If NULL, a workspace for maxDepth actions is allocated before the search starts.
+     */
+    void *workspace;
+    size_t workspaceSize;
+    /** number of entries in the IDA* transposition table, which is carved out of the workspace. 0 disables it. */
+    uint32_t transpositionEntries;
+    /**
+     * for goap_domain_plan(), the action list the domain was compiled from, so that the search can call the actions'
+     * checkFunctions. goap_planner_plan_ex() and the library planners fill this in themselves.
+     */
+    const goap_actionlist_t *actions;
+    /**
+     * for goap_domain_plan(), the start state as a world state. Its variables that aren't in the domain can't change
+     * during the search, and are passed to the actions' callbacks along with the domain's, so they see the same world
+     * as in the depth first search. goap_planner_plan_ex() and the library planners fill this in themselves.
+     */
+    const goap_worldstate_t *startWorld;
+    /**
+     * if not NULL, goap_planner_plan_ex() searches with the learner's macros as well as the actions, and records the
+     * plan it finds with it. Plans only ever contain the macros' steps, never the macros themselves. The plain depth
+     * first search records its plans but doesn't search with macros, since it tries every plan anyway.
+     */
+    goap_macro_learner_t *learner;
+    /**
+     * if non-zero, the goap_time_us() time at which the search gives up. It then returns the best plan it has so far,
+     * with no bound on how far from optimal it is, or GOAP_PLAN_BUDGET_EXCEEDED if it has none.
+     */
+    uint64_t deadlineUs;
+} goap_planner_options_t;
+
+/** Information about how a call to goap_planner_plan_ex() went */
+typedef struct {
+    goap_plan_status_t status;
+    /** number of search nodes that were expanded */
+    uint32_t nodesVisited;
+    /** number of complete plans the search came across */
+    uint32_t solutionsFound;
+    /** total cost of the returned plan, 0 if no plan was found */
+    uint32_t planCost;
+    /** number of actions left out of the search because they can't contribute to the goal */
+    uint32_t actionsPruned;
+    /** the returned plan costs at most this many times as much as the cheapest plan. INFINITY if there's no bound. */
+    float suboptimalityBound;
+    /** true if the search stopped because options.deadlineUs passed, rather than running out of memory or depth */
+    bool timedOut;
+    /** wall clock time spent planning, in microseconds */
+    uint64_t elapsedUs;
+    /** for goap_library_plan(), the library version that the plan's actions belong to. NULL otherwise. */
+    struct goap_library_version_t *libraryVersion;
+} goap_plan_stats_t;
+
+struct goap_domain_t;
+
+/** The part of an action list that can contribute to reaching a particular goal, see goap_relevance_compute() */
+typedef struct {
+    /** copy of the goal this was computed for, and its goap_worldstate_hash() */
+    goap_worldstate_t goal;
+    uint64_t goalHash;
+    /** the relevant actions. these are shallow copies, so free this list with da_free() only. */
+    goap_actionlist_t actions;
+    /** for each relevant action, its index in the action list the analysis was computed from */
+    uint32_t *indices;
+    /** the set of variables that the goal depends on, directly or through the preconditions of relevant actions */
+    map_bool_t variables;
+    /** the relevant actions compiled for the heuristics, NULL if they couldn't be compiled */
+    struct goap_domain_t *domain;
+} goap_relevance_t;
+
+DA_TYPEDEF(goap_relevance_t*, goap_relevancelist_t)
+
+/**
+ * A plan's actions as a partial order, see goap_partial_order_compute(). Actions are referred to by their index in the
+ * plan, and each action only has to wait for the ones it depends on, so actions that don't depend on each other can
+ * run at the same time.
+ */
+typedef struct {
+    /** how many actions the plan has */
+    uint32_t count;
+    /**
+     * the dependency graph: action i has to wait for dependencies[dependencyStart[i]] up to (but not including)
+     * dependencies[dependencyStart[i + 1]], which are all earlier in the plan. Dependencies that follow from the
+     * others are left out.
+     */
+    uint32_t *dependencyStart;
+    uint32_t *dependencies;
+    /** for each action, its layer: the number of actions in the longest chain of dependencies leading up to it */
+    uint32_t *layer;
+    /**
+     * the actions grouped by layer, in plan order within each one: layer l is byLayer[layerStart[l]] up to
+     * byLayer[layerStart[l + 1]]. Everything in a layer can run at the same time once the layers before it are done.
+     */
+    uint32_t layerCount;
+    uint32_t *layerStart;
+    uint32_t *byLayer;
+} goap_partial_order_t;
+
+/**
+ * One version of a library's actions, along with the data the planner has worked out about them. A version never
+ * changes once published, apart from its caches filling up, and is freed once nothing holds a reference to it.
+ */
+typedef struct goap_library_version_t {
+    goap_actionlist_t actions;
+    /** all of the actions compiled, or NULL if they couldn't be */
+    struct goap_domain_t *domain;
+    /** relevance analysis for each goal that has been planned for so far */
+    goap_relevancelist_t relevance;
+    /** protects the caches, so that a version can be planned on from several threads at once */
+    pthread_mutex_t lock;
+    /** 1 for the version the library was initialised with, counting up with every reload */
+    uint64_t generation;
+    /** number of references: one from the library while this is its current version, plus one per acquire */
+    atomic_uint refs;
+} goap_library_version_t;
+
+/**
+ * A handle to the current version of an action list, which can be replaced with goap_library_reload() while other
+ * threads are planning on it. Planners work on the version they acquired until they release it, and old versions are
+ * freed when their last planner lets go, so a reload never has to wait for a search to finish.
+ */
+typedef struct {
+    _Atomic(goap_library_version_t*) current;
+    /** generation of the current version, readable without acquiring it */
+    _Atomic uint64_t generation;
+    /**
+     * number of threads in the middle of goap_library_acquire(), split by the parity of the generation they saw, so a
+     * reload only waits for the ones that may have seen the version it replaced. see goap_library_reload().
+     */
+    atomic_uint acquiring[2];
+    /** serialises reloads */
+    pthread_mutex_t reloadLock;
+} goap_library_t;
+
+/**
+ * Calculates the optimal route of actions to take the agent from the current world state to the goal state, using
+ * the default options: the exhaustive depth first search (GOAP_SEARCH_DFS) with no heuristic. goap_planner_plan_ex()
+ * picks the search instead. If no plan could be created, prints an error and returns an empty list.
  *
  * The user is responsible for allocating and freeing all parameters from this function, so they can also handle
  * threading/multi-core synchronisation if necessary.
  * @param current the current GOAP state allocated by the user
  * @param goal the goal world state allocated by the user
  * @param allActions the list of actions available to the planner, try goap_parse_* to generate this
- * @returns if a successful plan was generated, an ordered linked list of the actions in the plan, otherwise an empty list.
- * The user must free this list with a call to da_free() but ABSOLUTELY NOT a call to goap_actionlist_free() or
+ * @returns if a successful plan was generated, an ordered linked list of the actions in the plan, otherwise an empty
+ * list. The user must free this list with a call to da_free() but ABSOLUTELY NOT a call to goap_actionlist_free() or
  * double frees will occur.
  */
-goap_actionlist_t goap_planner_plan(goap_worldstate_t currentWorld, goap_worldstate_t goal, goap_actionlist_t allActions);
+goap_actionlist_t goap_planner_plan(goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                                    goap_actionlist_t allActions);
+
+/**
+ * Same as goap_planner_plan(), but allows the search to be tuned and reports statistics about it. options.search
+ * picks the algorithm: the depth first search over world states, or, over the actions compiled into bitmasks (see
+ * goap_domain.h), uniform cost search, A*, weighted A*, greedy best first search or IDA*. If the actions can't be
+ * compiled, or with GOAP_STATIC when an action has a callback, it falls back to the depth first search.
+ * @param options search settings, or NULL for the defaults
+ * @param stats if not NULL, filled with information about the search
+ */
+goap_actionlist_t goap_planner_plan_ex(goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                                       goap_actionlist_t allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats);
+/**
+ * Same as goap_planner_plan_ex(), but takes everything by const pointer. The functions ending in _v2 are the ones the
+ * planner is built on, the others copy their arguments onto the stack and call through to them.
+ */
+goap_actionlist_t goap_planner_plan_v2(const goap_worldstate_t *currentWorld, const goap_worldstate_t *goal,
+                                       const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats);
+
+/**
+ * Expands a compound action into the actions it's made of, starting from the current world state. Call this once the
+ * compound action is next to run, so it's refined against the world as it is then rather than as the plan expected it
+ * to be. A sequence comes back as its steps, after checking their preconditions hold one after the other. Other
+ * compound actions are planned for with the given options, reaching their postConditions using only their subActions.
+ * The result may contain compound actions too, which are refined the same way when their turn comes. A primitive
+ * action comes back on its own.
+ * @param allActions the list the compound action's subActions are looked up in
+ * @param stats if not NULL, filled with information about the refinement. Its status tells a compound action that
+ * can't be refined in this world state (a sign it's time to replan) apart from one with nothing left to do.
+ * @returns the actions to run in its place, which must be freed with da_free()
+ */
+goap_actionlist_t goap_planner_refine(const goap_action_t *action, const goap_worldstate_t *currentWorld,
+                                      const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                      goap_plan_stats_t *stats);
+/**
+ * Works out a sequence's preConditions, postConditions and cost from its steps, replacing whatever it had. It needs
+ * everything a step needs that no earlier step provides, has the combined effect of all the steps, and costs their
+ * total. Steps that are compound themselves are used as they are, so they need their conditions first.
+ * @param allActions the list the steps are looked up in
+ * @return false, leaving the action untouched, if a step doesn't exist or the steps can never run in order (one needs
+ * a variable to have a value that an earlier step, or the sequence's preconditions, rule out)
+ */
+bool goap_action_summarise(goap_action_t *action, const goap_actionlist_t *allActions);
+/** Returns the action with the given name, or NULL if there isn't one */
+goap_action_t *goap_actionlist_find(const goap_actionlist_t *list, const char *name);
+
+/** Initialises a macro learner with the default settings, which can be changed before it's first used */
+void goap_macro_learner_init(goap_macro_learner_t *learner);
+/** Frees a macro learner and the macros it learned */
+void goap_macro_learner_free(goap_macro_learner_t *learner);
+/**
+ * Counts the runs of consecutive actions in a plan, and every updateInterval plans, works out the macros again.
+ * goap_planner_plan_ex() calls this itself when it's given a learner, but plans found some other way (for example by a
+ * library) can be recorded too.
+ * @param allActions the list the plan's actions came from, which macros look their steps up in
+ */
+void goap_macro_learner_record(goap_macro_learner_t *learner, const goap_actionlist_t *plan,
+                               const goap_actionlist_t *allActions);
+/**
+ * Works out the macros from the counts so far: the runs seen at least minCount times, with the ones that would save
+ * the search the most steps first. A run is left out if one of its actions has a checkFunction or costFunction (whose
+ * results a macro can't summarise), is internal, or isn't in allActions, and so is a run that's only ever been seen
+ * inside a longer one that's already a macro.
+ */
+void goap_macro_learner_update(goap_macro_learner_t *learner, const goap_actionlist_t *allActions);
+/**
+ * Returns copies of the learned macros whose steps are all in allActions and could still be learned, which are
+ * ordinary compound sequences that can be planned with and refined. Their conditions and cost are summarised again
+ * from the steps in allActions, and a macro whose steps can no longer run in order is left out. They don't change
+ * when the learner does, and must be freed with goap_actionlist_free().
+ */
+goap_actionlist_t goap_macro_learner_macros(goap_macro_learner_t *learner, const goap_actionlist_t *allActions);
+
+/**
+ * Works out which actions can possibly help reach the goal, by chaining backwards from it: an action is relevant if
+ * one of its post conditions sets a variable to a value needed by the goal or by a relevant action's preconditions,
+ * or changes one of the checkVariables or costVariables of a relevant action's checkFunction or costFunction. If a
+ * relevant action's check or cost depends on the whole world state, every action is kept. Any plan that uses other
+ * actions still works (and is no more expensive) with them removed, so searching over just the relevant actions loses
+ * nothing. Internal actions are never relevant, since only compound actions may use them.
+ * @param out filled with the result, which must be freed with goap_relevance_free()
+ */
+void goap_relevance_compute(goap_actionlist_t allActions, goap_worldstate_t goal, goap_relevance_t *out);
+/** Frees the contents of a goap_relevance_t */
+void goap_relevance_free(goap_relevance_t *relevance);
+/**
+ * Works out which of a plan's actions depend on each other. An action depends on an earlier one if it reads a variable
+ * the earlier one sets (in its preconditions, or the variables its check or cost depend on), if it sets a variable
+ * the earlier one reads, or if they both set a variable to different values. Running the actions in any order that
+ * respects the dependencies, or running independent ones at the same time, reaches the same world state as the plan
+ * and every action sees the same values it was planned with. Compound actions are taken at their own conditions, so
+ * refine them first to overlap their steps with other actions.
+ * @param out filled with the result, which must be freed with goap_partial_order_free()
+ */
+void goap_partial_order_compute(const goap_actionlist_t *plan, goap_partial_order_t *out);
+/** Frees the contents of a goap_partial_order_t */
+void goap_partial_order_free(goap_partial_order_t *order);
+
+/** Initialises a library that takes ownership of the given actions (for example, from goap_parse_json()) */
+void goap_library_init(goap_library_t *library, goap_actionlist_t actions);
+/**
+ * Frees the library. Its current version is released, so it's freed straight away unless a planner still holds it, in
+ * which case it's freed by that planner's goap_library_release().
+ */
+void goap_library_free(goap_library_t *library);
+/**
+ * Replaces the library's actions with a new set, which the library takes ownership of. Planners that already hold the
+ * old version keep using it, everything acquired afterwards sees the new one. The new version starts with empty
+ * caches, so nothing worked out for the old actions is reused. This is safe to call while other threads are planning.
+ * @returns the generation of the new version
+ */
+uint64_t goap_library_reload(goap_library_t *library, goap_actionlist_t actions);
+/** Returns the generation of the library's current version */
+uint64_t goap_library_generation(goap_library_t *library);
+/**
+ * Returns the library's current version with a reference held on it, which must be given back with
+ * goap_library_release(). This never blocks, even while a reload is in progress.
+ */
+goap_library_version_t *goap_library_acquire(goap_library_t *library);
+/** Takes another reference on a version that the caller already holds */
+void goap_library_retain(goap_library_version_t *version);
+/** Releases a reference, freeing the version if it was the last one and the version is no longer current */
+void goap_library_release(goap_library_version_t *version);
+/**
+ * Returns the relevance analysis for the given goal, computing it the first time a goal is seen. The result is owned by
+ * the version and stays valid for as long as the caller holds it.
+ */
+const goap_relevance_t *goap_library_relevance(goap_library_version_t *version, goap_worldstate_t goal);
+/** Same as goap_library_relevance(), but takes the goal by pointer */
+const goap_relevance_t *goap_library_relevance_v2(goap_library_version_t *version, const goap_worldstate_t *goal);
+/**
+ * Same as goap_planner_plan_ex(), but only searches over the version's actions that are relevant to the goal.
+ * This is safe to call from multiple threads on the same version. The plan's actions belong to the version, so the
+ * caller must hold it until it's done with the plan.
+ */
+goap_actionlist_t goap_library_plan(goap_library_version_t *version, goap_worldstate_t currentWorld,
+                                    goap_worldstate_t goal, const goap_planner_options_t *options,
+                                    goap_plan_stats_t *stats);
+/** Same as goap_library_plan(), but takes the world states by pointer */
+goap_actionlist_t goap_library_plan_v2(goap_library_version_t *version, const goap_worldstate_t *currentWorld,
+                                       const goap_worldstate_t *goal, const goap_planner_options_t *options,
+                                       goap_plan_stats_t *stats);
+/**
+ * Same as goap_library_plan(), but writes the plan into the caller's buffer as indices into version->actions, so
+ * nothing is copied or allocated for the result. Indices stay meaningful for as long as the version does, so plans in
+ * this form can be cached or written out and compared cheaply. This always searches the compiled domain, so
+ * GOAP_SEARCH_DFS (including zeroed options) runs A* with the given heuristic instead, and the stats describe that
+ * search. If the actions couldn't be compiled no plan is found.
+ * @param options search settings, or NULL for A* with no heuristic
+ * @param plan buffer that receives the indices of the plan's actions, in order
+ * @param capacity number of entries the plan buffer can hold
+ * @param length receives the number of actions in the plan, which may exceed capacity if GOAP_PLAN_TOO_LONG is
+ * returned
+ */
+goap_plan_status_t goap_library_plan_indices(goap_library_version_t *version, goap_worldstate_t currentWorld,
+                                             goap_worldstate_t goal, const goap_planner_options_t *options,
+                                             goap_plan_stats_t *stats, uint32_t *plan, size_t capacity,
+                                             size_t *length);
+/** Same as goap_library_plan_indices(), but takes the world states by pointer */
+goap_plan_status_t goap_library_plan_indices_v2(goap_library_version_t *version, const goap_worldstate_t *currentWorld,
+                                                const goap_worldstate_t *goal, const goap_planner_options_t *options,
+                                                goap_plan_stats_t *stats, uint32_t *plan, size_t capacity,
+                                                size_t *length);
 
 /**
  * Generates a goap_actionlist_t by deserialising a JSON document. Checks for malformed documents and related errors.
+ * Besides the usual fields, an action may list "steps" (the names of the actions it runs in order) or "subActions"
+ * (the actions its sub-plan may use) to make it a compound action, and "internal": true keeps it out of top-level
+ * plans. A sequence's preConditions, postConditions and cost may be left out, and are then worked out from its steps.
  *
  * NOTE: You must call goap_actionlist_free() to delete this list and its contents properly.
  * @param str the contents of the JSON document
  */
 goap_actionlist_t goap_parse_json(char *str, size_t length);
-/** TODO implement this */
-goap_actionlist_t goap_parse_protobuf(void);
+/**
+ * Loads a domain written by goap_domain_save_binary() (or the goap_compile tool). The file is mapped into memory and
+ * used in place, so loading doesn't parse anything or allocate per action. With GOAP_STATIC, it's copied into the
+ * domain's arrays instead. The file is checked to be well formed before it's used.
+ * @return true on success, in which case the domain must be freed with goap_domain_free()
+ */
+bool goap_load_binary(struct goap_domain_t *domain, const char *path);
 /** Free all resources associated with the given action list */
 void goap_actionlist_free(goap_actionlist_t *list);
 /** Dumps a goap_actionlist_t to the console */
 void goap_actionlist_dump(goap_actionlist_t list);
 /** Compares two world states and returns true if they're functionally equivalent, ignoring extraneous keys */
 bool goap_worldstate_compare(goap_worldstate_t currentState, goap_worldstate_t goal);
+/** Same as goap_worldstate_compare(), but takes the world states by pointer */
+bool goap_worldstate_compare_v2(const goap_worldstate_t *restrict currentState, const goap_worldstate_t *restrict goal);
 /** Dumps a goap_worldstate_t to the console */
-void goap_worldstate_dump(goap_worldstate_t world);
\ No newline at end of file
+void goap_worldstate_dump(goap_worldstate_t world);
+/**
+ * Returns a hash of the given world state that doesn't depend on the order keys were inserted in, so two world states
+ * with the same contents always have the same hash.
+ */
+uint64_t goap_worldstate_hash(goap_worldstate_t world);
+/** Same as goap_worldstate_hash(), but takes the world state by pointer */
+uint64_t goap_worldstate_hash_v2(const goap_worldstate_t *world);
+/** Returns a deep copy of the given world state, which must be freed with map_deinit() */
+goap_worldstate_t goap_worldstate_clone(goap_worldstate_t world);
+/** Same as goap_worldstate_clone(), but takes the world state by pointer */
+goap_worldstate_t goap_worldstate_clone_v2(const goap_worldstate_t *world);
+/**
+ * Looks up a variable, returning NULL if it isn't set. Unlike map_get(), this doesn't write to the map, so it works on
+ * const world states and is safe to call from several threads at once.
+ */
+static inline const bool *goap_worldstate_get(const goap_worldstate_t *world, const char *key) {
+    return map_get_(&world->base, key);
+}
+
+/**
+ * Returns the symbol for a name, interning it if it hasn't been seen before. Symbols are shared by the whole program
+ * and are never freed. Safe to call from several threads at once.
+ */
+goap_symbol_t goap_symbol_intern(const char *name);
+/** Returns the symbol for a name, or GOAP_SYMBOL_NONE if it has never been interned */
+goap_symbol_t goap_symbol_find(const char *name);
+/** Returns the name of a symbol, which stays valid for the life of the program, or NULL if it isn't a symbol */
+const char *goap_symbol_name(goap_symbol_t symbol);
+
+/** Looks up a variable in a persistent world state, returning NULL if it isn't set */
+const bool *goap_pworld_get(const goap_pworld_t *world, const char *key);
+/** Same as goap_pworld_get(), but takes the variable's symbol, which skips looking up the name */
+const bool *goap_pworld_get_symbol(const goap_pworld_t *world, goap_symbol_t symbol);
+/** Sets a variable in a persistent world state, without affecting any of the states it was cloned from or to */
+void goap_pworld_set(goap_pworld_t *world, const char *key, bool value);
+/** Same as goap_pworld_set(), but takes the variable's symbol */
+void goap_pworld_set_symbol(goap_pworld_t *world, goap_symbol_t symbol, bool value);
+/** Unsets a variable in a persistent world state */
+void goap_pworld_remove(goap_pworld_t *world, const char *key);
+/** Returns a copy of the persistent world state in O(1), which must be freed with goap_pworld_free() */
+goap_pworld_t goap_pworld_clone(const goap_pworld_t *world);
+/** Releases a persistent world state, which frees whatever isn't shared with other copies */
+void goap_pworld_free(goap_pworld_t *world);
+/** Like map_iter(), starts iterating over a persistent world state */
+goap_pworld_iter_t goap_pworld_iter(const goap_pworld_t *world);
+/**
+ * Like map_next(), returns the next variable or NULL once they've all been seen, and points iter->value at its value.
+ * The world state must not change while it's being iterated over.
+ */
+const char *goap_pworld_next(const goap_pworld_t *world, goap_pworld_iter_t *iter);
+/** Returns a persistent copy of a world state, which must be freed with goap_pworld_free() */
+goap_pworld_t goap_pworld_from_worldstate(const goap_worldstate_t *world);
+/** Same as goap_worldstate_compare(), for a persistent world state */
+bool goap_pworld_compare(const goap_pworld_t *world, const goap_worldstate_t *goal);
+/** Dumps a goap_pworld_t to the console */
+void goap_pworld_dump(const goap_pworld_t *world);
+/** Returns a monotonic timestamp in microseconds, used to measure planning time */
+uint64_t goap_time_us(void);
+
+/** number of nodes the searches expand between looking at the clock, when they have a deadline */
+#define GOAP_DEADLINE_INTERVAL 64
+
+/** Returns true if the options have a deadline and it has passed. Only reads the clock every so many nodes. */
+static inline bool goap_deadline_passed(const goap_planner_options_t *options, uint32_t nodesVisited) {
+    return options->deadlineUs != 0 && nodesVisited % GOAP_DEADLINE_INTERVAL == 0
+           && goap_time_us() >= options->deadlineUs;
+}
\ No newline at end of file
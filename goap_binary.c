@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// The binary domain format is a compiled domain written straight to disk, so that it can be mapped and used in
+// place. All values are in the byte order of the machine that wrote the file. The layout is:
+//
+//   goap_binary_header_t
+//   goap_compiled_action_t actions[numActions]
+//   goap_cond_t alternatives[numAlternatives]
+//   goap_compiled_number_t numbers[numNumbers]
+//   uint32_t varNames[numVars]      offsets into the string table
+//   uint32_t sortedVars[numVars]    every variable, in order of their names
+//   char strings[stringsSize]       every name, each one NUL terminated
+//
+// The header and records are multiples of 8 bytes, so everything is correctly aligned in the mapping.
+//
+// Version history:
+// 1: initial version
+// 2: added precondition alternatives
+// 3: added the goal and the hash of the source file, for the compilation cache
+// 4: added the state width, since it depends on GOAP_MAX_VARS
+// 5: added numbers, so that their declared largest values survive compilation
+// 6: added the variables sorted by name, so that names can be looked up in a mapped domain with a binary search
+
+#define BINARY_MAGIC "GOAP"
+#define BINARY_VERSION 6
+/** written as-is, so a file from a machine with the other byte order reads as 0x0201 */
+#define BINARY_BYTE_ORDER 0x0102
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t byteOrder;
+    uint32_t numActions;
+    uint32_t numVars;
+    uint32_t stringsSize;
+    uint32_t numAlternatives;
+    uint32_t numGoalAlternatives;
+    /** GOAP_STATE_WORDS of the writer, which decides the size of every goap_cond_t in the file */
+    uint32_t stateWords;
+    uint32_t numNumbers;
+    uint32_t reserved;
+    /** hash of the file the domain was compiled from, if it came from the cache, otherwise 0 */
+    uint64_t sourceHash;
+} goap_binary_header_t;
+
+_Static_assert(sizeof(goap_binary_header_t) % 8 == 0, "action records must stay 8 byte aligned");
+_Static_assert(sizeof(goap_compiled_action_t) == sizeof(goap_cond_t) * 2 + 16,
+               "goap_compiled_action_t is part of the file format");
+_Static_assert(sizeof(goap_compiled_number_t) == 16, "goap_compiled_number_t is part of the file format");
+
+/** returns the total file size described by the header */
+static size_t binary_size(const goap_binary_header_t *header) {
+    return sizeof(goap_binary_header_t) + sizeof(goap_compiled_action_t) * (size_t) header->numActions
+           + sizeof(goap_cond_t) * (size_t) header->numAlternatives
+           + sizeof(goap_compiled_number_t) * (size_t) header->numNumbers
+           + sizeof(uint32_t) * 2 * (size_t) header->numVars + header->stringsSize;
+}
+
+/** returns true if the mask only uses the first numVars bits */
+static bool mask_valid(const goap_bits_t *mask, uint32_t numVars) {
+    const uint64_t *words = goap_bits_cwords(mask);
+    for (uint32_t i = 0; i < GOAP_STATE_WORDS; i++) {
+        uint32_t first = i * 64;
+        uint64_t valid = numVars >= first + 64 ? ~(uint64_t) 0
+                         : numVars <= first    ? 0
+                                               : ((uint64_t) 1 << (numVars - first)) - 1;
+        if (words[i] & ~valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** checks that the file is a domain we can use without any further bounds checks */
+static bool binary_validate(const uint8_t *data, size_t size) {
+    const goap_binary_header_t *header = (const goap_binary_header_t*) data;
+    if (size < sizeof(goap_binary_header_t) || memcmp(header->magic, BINARY_MAGIC, 4) != 0) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Not a GOAP binary domain\n");
+#endif
+        return false;
+    }
+    if (header->byteOrder != BINARY_BYTE_ORDER || header->version != BINARY_VERSION) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Binary domain has version %d and byte order %x, we need version %d and byte order %x\n",
+                header->version, header->byteOrder, BINARY_VERSION, BINARY_BYTE_ORDER);
+#endif
+        return false;
+    }
+    if (header->stateWords != GOAP_STATE_WORDS) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Binary domain has %u word states, we were built with GOAP_MAX_VARS for %d\n",
+                header->stateWords, GOAP_STATE_WORDS);
+#endif
+        return false;
+    }
+    if (header->numVars > GOAP_MAX_VARS || header->numActions > UINT32_MAX / sizeof(goap_compiled_action_t)
+        || header->numAlternatives > UINT32_MAX / sizeof(goap_cond_t)
+        || header->numGoalAlternatives > header->numAlternatives || header->numNumbers > header->numVars
+        || binary_size(header) != size) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Binary domain is truncated or corrupt\n");
+#endif
+        return false;
+    }
+    const goap_compiled_action_t *actions = (const goap_compiled_action_t*) (data + sizeof(goap_binary_header_t));
+    const goap_cond_t *alternatives = (const goap_cond_t*) (actions + header->numActions);
+    const goap_compiled_number_t *numbers = (const goap_compiled_number_t*) (alternatives + header->numAlternatives);
+    const uint32_t *varNames = (const uint32_t*) (numbers + header->numNumbers);
+    const uint32_t *sortedVars = varNames + header->numVars;
+    const char *strings = (const char*) (sortedVars + header->numVars);
+    if (header->stringsSize > 0 && strings[header->stringsSize - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->numActions; i++) {
+        if (actions[i].name >= header->stringsSize || !mask_valid(&actions[i].pre.mask, header->numVars)
+            || !mask_valid(&actions[i].post.mask, header->numVars)
+            || actions[i].firstAlternative > header->numAlternatives
+            || actions[i].numAlternatives > header->numAlternatives - actions[i].firstAlternative) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->numAlternatives; i++) {
+        if (!mask_valid(&alternatives[i].mask, header->numVars)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->numNumbers; i++) {
+        const goap_compiled_number_t *number = &numbers[i];
+        if (number->name >= header->stringsSize || number->width == 0 || number->width > 16
+            || number->first > header->numVars || number->width > header->numVars - number->first
+            || number->max == 0 || number->max > (1u << number->width) - 1) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->numVars; i++) {
+        if (varNames[i] >= header->stringsSize) {
+            return false;
+        }
+    }
+    // the names have to be in strictly increasing order for the binary search, which also means no variable is missing
+    // or listed twice
+    for (uint32_t i = 0; i < header->numVars; i++) {
+        if (sortedVars[i] >= header->numVars
+            || (i > 0 && strcmp(strings + varNames[sortedVars[i - 1]], strings + varNames[sortedVars[i]]) >= 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** loads a binary domain, see goap_load_binary(), and returns the hash of the file it was compiled from */
+static bool binary_load(goap_domain_t *domain, const char *path, uint64_t *sourceHash) {
+    memset(domain, 0, sizeof(*domain));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+#if GOAP_DEBUG
+        perror("Failed to open binary domain");
+#endif
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(goap_binary_header_t)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+
+#if GOAP_STATIC
+    // read the header first, to check the rest will fit in the domain's arrays
+    goap_binary_header_t header;
+    if (read(fd, &header, sizeof(header)) != (ssize_t) sizeof(header) || header.numActions > GOAP_MAX_ACTIONS
+        || header.stringsSize > GOAP_MAX_STRINGS || header.numAlternatives > GOAP_MAX_ALTERNATIVES
+        || binary_size(&header) != size) {
+        close(fd);
+        return false;
+    }
+    // read the rest into a static buffer, check it as if it were mapped, then copy it into the arrays
+    static uint8_t buffer[sizeof(goap_binary_header_t) + sizeof(goap_compiled_action_t) * GOAP_MAX_ACTIONS
+                          + sizeof(goap_cond_t) * GOAP_MAX_ALTERNATIVES
+                          + (sizeof(goap_compiled_number_t) + sizeof(uint32_t) * 2) * GOAP_MAX_VARS + GOAP_MAX_STRINGS];
+    memcpy(buffer, &header, sizeof(header));
+    size_t done = sizeof(header);
+    while (done < size) {
+        ssize_t got = read(fd, buffer + done, size - done);
+        if (got <= 0) {
+            close(fd);
+            return false;
+        }
+        done += got;
+    }
+    close(fd);
+    if (!binary_validate(buffer, size)) {
+        return false;
+    }
+    const uint8_t *data = buffer;
+#else
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+#if GOAP_DEBUG
+        perror("Failed to map binary domain");
+#endif
+        return false;
+    }
+    if (!binary_validate(mapping, size)) {
+        munmap(mapping, size);
+        return false;
+    }
+    const uint8_t *data = mapping;
+#endif
+
+    const goap_binary_header_t *fileHeader = (const goap_binary_header_t*) data;
+    const goap_compiled_action_t *actions = (const goap_compiled_action_t*) (data + sizeof(goap_binary_header_t));
+    const goap_cond_t *alternatives = (const goap_cond_t*) (actions + fileHeader->numActions);
+    const goap_compiled_number_t *numbers =
+        (const goap_compiled_number_t*) (alternatives + fileHeader->numAlternatives);
+    const uint32_t *varNames = (const uint32_t*) (numbers + fileHeader->numNumbers);
+    const uint32_t *sortedVars = varNames + fileHeader->numVars;
+    const char *strings = (const char*) (sortedVars + fileHeader->numVars);
+    domain->numActions = fileHeader->numActions;
+    domain->numAlternatives = fileHeader->numAlternatives;
+    domain->numGoalAlternatives = fileHeader->numGoalAlternatives;
+    domain->numNumbers = fileHeader->numNumbers;
+    *sourceHash = fileHeader->sourceHash;
+    domain->numVars = fileHeader->numVars;
+    domain->stringsSize = fileHeader->stringsSize;
+#if GOAP_STATIC
+    memcpy(domain->actions, actions, sizeof(goap_compiled_action_t) * domain->numActions);
+    memcpy(domain->alternatives, alternatives, sizeof(goap_cond_t) * domain->numAlternatives);
+    memcpy(domain->numbers, numbers, sizeof(goap_compiled_number_t) * domain->numNumbers);
+    memcpy(domain->varNames, varNames, sizeof(uint32_t) * domain->numVars);
+    memcpy(domain->sortedVars, sortedVars, sizeof(uint32_t) * domain->numVars);
+    memcpy(domain->strings, strings, domain->stringsSize);
+#else
+    // the domain is read only from here on, so it can point straight into the mapping
+    domain->actions = (goap_compiled_action_t*) actions;
+    domain->alternatives = (goap_cond_t*) alternatives;
+    domain->numbers = (goap_compiled_number_t*) numbers;
+    domain->varNames = (uint32_t*) varNames;
+    domain->sortedVars = (uint32_t*) sortedVars;
+    domain->strings = (char*) strings;
+    domain->mapping = mapping;
+    domain->mappingSize = size;
+#endif
+    return true;
+}
+
+bool goap_load_binary(goap_domain_t *domain, const char *path) {
+    uint64_t sourceHash;
+    return binary_load(domain, path, &sourceHash);
+}
+
+/** writes count items to the file, returns true on success. Unlike fwrite(), data may be NULL if count is 0. */
+static bool write_array(FILE *f, const void *data, size_t itemSize, size_t count) {
+    return count == 0 || fwrite(data, itemSize, count, f) == count;
+}
+
+/** writes the domain to the file and closes it, recording the hash of the file it was compiled from */
+static bool binary_write(const goap_domain_t *domain, FILE *f, uint64_t sourceHash) {
+    goap_binary_header_t header = {0};
+    memcpy(header.magic, BINARY_MAGIC, 4);
+    header.version = BINARY_VERSION;
+    header.byteOrder = BINARY_BYTE_ORDER;
+    header.stateWords = GOAP_STATE_WORDS;
+    header.numActions = domain->numActions;
+    header.numVars = domain->numVars;
+    header.stringsSize = domain->stringsSize;
+    header.numAlternatives = domain->numAlternatives;
+    header.numGoalAlternatives = domain->numGoalAlternatives;
+    header.numNumbers = domain->numNumbers;
+    header.sourceHash = sourceHash;
+
+    bool ok = write_array(f, &header, sizeof(header), 1)
+              && write_array(f, domain->actions, sizeof(goap_compiled_action_t), domain->numActions)
+              && write_array(f, domain->alternatives, sizeof(goap_cond_t), domain->numAlternatives)
+              && write_array(f, domain->numbers, sizeof(goap_compiled_number_t), domain->numNumbers)
+              && write_array(f, domain->varNames, sizeof(uint32_t), domain->numVars)
+              && write_array(f, domain->sortedVars, sizeof(uint32_t), domain->numVars)
+              && write_array(f, domain->strings, 1, domain->stringsSize);
+    ok = fclose(f) == 0 && ok;
+    return ok;
+}
+
+/** writes a binary domain, see goap_domain_save_binary(), recording the hash of the file it was compiled from */
+static bool binary_save(const goap_domain_t *domain, const char *path, uint64_t sourceHash) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+#if GOAP_DEBUG
+        perror("Failed to open binary domain for writing");
+#endif
+        return false;
+    }
+    return binary_write(domain, f, sourceHash);
+}
+
+bool goap_domain_save_binary(const goap_domain_t *domain, const char *path) {
+    return binary_save(domain, path, 0);
+}
+
+// The compilation cache keeps one binary domain per source file, named after a hash of the source's path. The entry
+// records a hash of the source's contents, so if the source changes, the entry no longer matches and is overwritten
+// with a fresh compile. Entries are written to a temporary file and renamed into place, so a process never sees a
+// half written entry.
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+bool goap_domain_load_cached(goap_domain_t *domain, const char *path, const char *cacheDir, goap_parse_error_t *error) {
+    memset(domain, 0, sizeof(*domain));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+#if GOAP_DEBUG
+        perror("Failed to open domain file");
+#endif
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    // mmap can't map an empty file, so give the parsers an empty string instead
+    const char *source = "";
+    void *mapping = NULL;
+    if (size > 0) {
+        mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        source = mapping;
+    }
+    close(fd);
+    size_t pathLength = strlen(path);
+    bool json = pathLength >= 5 && strcmp(path + pathLength - 5, ".json") == 0;
+    // the hash also covers the language, so renaming a file to the other extension doesn't pick up a stale entry
+    uint64_t sourceHash = fnv1a(source, size, json ? FNV_OFFSET_BASIS : ~FNV_OFFSET_BASIS);
+
+    char cachePath[4096] = {0};
+    bool ok = false;
+    if (cacheDir != NULL) {
+        int written = snprintf(cachePath, sizeof(cachePath), "%s/%016llx.goapb", cacheDir,
+                               (unsigned long long) fnv1a(path, pathLength, FNV_OFFSET_BASIS));
+        if (written < 0 || (size_t) written >= sizeof(cachePath)) {
+            cachePath[0] = '\0';
+        }
+    }
+    if (cachePath[0] != '\0') {
+        uint64_t cachedHash;
+        if (access(cachePath, R_OK) == 0 && binary_load(domain, cachePath, &cachedHash)) {
+            ok = cachedHash == sourceHash;
+            if (!ok) {
+                goap_domain_free(domain);
+            }
+        }
+    }
+    if (!ok) {
+        ok = json ? goap_domain_load_json(domain, source, size, error)
+                  : goap_domain_load_text(domain, source, size, NULL, error);
+        if (ok && cachePath[0] != '\0') {
+            // a failure to write the cache only costs us time on the next load, so it isn't an error
+            // mkstemp() picks a name nobody else is using, so threads and processes compiling the same source at
+            // once each write their own file, and whichever is renamed into place last wins
+            char tempPath[sizeof(cachePath) + 32];
+            snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", cachePath);
+            int tempFd = mkstemp(tempPath);
+            FILE *temp = tempFd >= 0 ? fdopen(tempFd, "wb") : NULL;
+            if (temp == NULL) {
+                if (tempFd >= 0) {
+                    close(tempFd);
+                    unlink(tempPath);
+                }
+            } else {
+                // mkstemp() only lets the owner read it, but the entry is no more private than its source
+                fchmod(tempFd, 0644);
+                if (!binary_write(domain, temp, sourceHash) || rename(tempPath, cachePath) != 0) {
+                    unlink(tempPath);
+                }
+            }
+        }
+    }
+    if (mapping != NULL) {
+        munmap(mapping, size);
+    }
+    return ok;
+}
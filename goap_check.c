@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Memoises the actions' callbacks for the length of one planning call. A check is only run once an action's cheap
+// preconditions hold, and each result is stored under the action, which callback it came from and the values of the
+// variables the callback depends on, so a search that reaches the same situation through many paths only runs it once.
+// The table is found by a hash of that key, but the key itself is kept too, so a collision can't return another
+// situation's result.
+
+#define CACHE_INITIAL_SIZE 64
+/** mixed into the keys so that an action's check and cost results never share an entry */
+#define CHECK_SALT 0x9e3779b97f4a7c15ULL
+#define COST_SALT 0xc2b2ae3d27d4eb4fULL
+
+/** compiles a set of variable names, or every variable in the domain if it's empty */
+static void compile_relevant(const goap_domain_t *domain, const map_bool_t *variables, goap_bits_t *out) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(variables, &iter))) {
+        int bit = goap_domain_var_index(domain, key);
+        if (bit >= 0) {
+            goap_bits_set(out, bit);
+        }
+    }
+    if (variables->base.nnodes == 0) {
+        for (uint32_t var = 0; var < domain->numVars; var++) {
+            goap_bits_set(out, var);
+        }
+    }
+}
+
+void goap_check_init(goap_check_cache_t *cache, const goap_domain_t *domain, const goap_actionlist_t *actions,
+                     const goap_worldstate_t *startWorld) {
+    memset(cache, 0, sizeof(*cache));
+    cache->actions = actions;
+    cache->domain = domain;
+    if (actions == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < da_count(*actions) && !cache->enabled; i++) {
+        cache->enabled = actions->p[i].checkFunction != NULL || actions->p[i].costFunction != NULL;
+    }
+    if (!cache->enabled || domain == NULL) {
+        return;
+    }
+    cache->checkRelevant = calloc(da_count(*actions), sizeof(goap_bits_t));
+    cache->costRelevant = calloc(da_count(*actions), sizeof(goap_bits_t));
+    for (size_t i = 0; i < da_count(*actions); i++) {
+        const goap_action_t *action = &actions->p[i];
+        if (action->checkFunction != NULL) {
+            compile_relevant(domain, &action->checkVariables, &cache->checkRelevant[i]);
+        }
+        if (action->costFunction != NULL) {
+            compile_relevant(domain, &action->costVariables, &cache->costRelevant[i]);
+        }
+    }
+    if (startWorld != NULL) {
+        map_iter_t iter = map_iter();
+        const char *key = NULL;
+        while ((key = map_next(startWorld, &iter))) {
+            if (goap_domain_var_index(domain, key) < 0) {
+                map_set(&cache->fixed, key, *(const bool*) map_get_(&startWorld->base, key));
+            }
+        }
+    }
+}
+
+void goap_check_free(goap_check_cache_t *cache) {
+    free(cache->checkRelevant);
+    free(cache->costRelevant);
+    free(cache->entries);
+    free(cache->keys);
+    map_deinit(&cache->fixed);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void *goap_check_key(goap_check_cache_t *cache, size_t size) {
+    if (cache->keysSize + size > cache->keysCapacity) {
+        cache->keysCapacity = cache->keysCapacity > 0 ? cache->keysCapacity * 2 : CACHE_INITIAL_SIZE * 16;
+        while (cache->keysSize + size > cache->keysCapacity) {
+            cache->keysCapacity *= 2;
+        }
+        cache->keys = realloc(cache->keys, cache->keysCapacity);
+    }
+    cache->pendingSize = size;
+    return cache->keys + cache->keysSize;
+}
+
+/** returns the pending key's slot, which is empty if the key isn't in the table */
+static goap_check_entry_t *cache_slot(const goap_check_cache_t *cache, uint64_t hash) {
+    uint32_t mask = cache->size - 1;
+    const uint8_t *key = cache->keys + cache->keysSize;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        const goap_check_entry_t *entry = &cache->entries[i];
+        if (entry->hash == 0 || (entry->hash == hash && entry->size == cache->pendingSize
+                                 && memcmp(cache->keys + entry->offset, key, entry->size) == 0)) {
+            return &cache->entries[i];
+        }
+    }
+}
+
+bool goap_check_lookup(const goap_check_cache_t *cache, uint64_t hash, uint32_t *result) {
+    if (cache->size == 0) {
+        return false;
+    }
+    // a hash of 0 would look like an empty slot
+    goap_check_entry_t *entry = cache_slot(cache, hash ? hash : 1);
+    if (entry->hash == 0) {
+        return false;
+    }
+    *result = entry->value;
+    return true;
+}
+
+void goap_check_store(goap_check_cache_t *cache, uint64_t hash, uint32_t result) {
+    if ((cache->count + 1) * 2 > cache->size) {
+        goap_check_entry_t *old = cache->entries;
+        uint32_t oldSize = cache->size;
+        cache->size = oldSize > 0 ? oldSize * 2 : CACHE_INITIAL_SIZE;
+        cache->entries = calloc(cache->size, sizeof(goap_check_entry_t));
+        for (uint32_t i = 0; i < oldSize; i++) {
+            if (old[i].hash != 0) {
+                // the keys in the table are all different, so each one just goes in the first free slot
+                uint32_t slot = old[i].hash & (cache->size - 1);
+                while (cache->entries[slot].hash != 0) {
+                    slot = (slot + 1) & (cache->size - 1);
+                }
+                cache->entries[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    hash = hash ? hash : 1;
+    goap_check_entry_t *slot = cache_slot(cache, hash);
+    if (slot->hash == 0) {
+        // keep the pending key where goap_check_key() put it
+        *slot = (goap_check_entry_t) {hash, cache->keysSize, cache->pendingSize, result};
+        cache->keysSize += cache->pendingSize;
+        cache->count++;
+    }
+    slot->value = result;
+    cache->pendingSize = 0;
+}
+
+/**
+ * restricts the state to the relevant variables, and makes the cache key for the action's callback on that: the
+ * action, whether it's the costFunction, and the restricted state. The start state's variables outside the domain are
+ * part of what the callback sees too, but which of them it gets only depends on the action and callback, so they're
+ * covered by those. Returns the key's hash
+ */
+static uint64_t compiled_key(goap_check_cache_t *cache, uint32_t action, const goap_bits_t *relevant,
+                             uint64_t salt, const goap_cond_t *state, goap_cond_t *view) {
+    uint32_t words = goap_domain_words(cache->domain);
+    const uint64_t *mask = goap_bits_cwords(relevant);
+    memset(view, 0, sizeof(*view));
+    for (uint32_t i = 0; i < words; i++) {
+        goap_bits_words(&view->mask)[i] = goap_bits_cwords(&state->mask)[i] & mask[i];
+        goap_bits_words(&view->value)[i] = goap_bits_cwords(&state->value)[i] & mask[i];
+    }
+    uint64_t callback = (uint64_t) action << 1 | (salt == COST_SALT);
+    uint8_t *key = goap_check_key(cache, sizeof(uint64_t) * (1 + 2 * words));
+    memcpy(key, &callback, sizeof(uint64_t));
+    memcpy(key + sizeof(uint64_t), goap_bits_cwords(&view->mask), sizeof(uint64_t) * words);
+    memcpy(key + sizeof(uint64_t) * (1 + words), goap_bits_cwords(&view->value), sizeof(uint64_t) * words);
+    uint64_t hash = goap_cond_hash_n(view, words) ^ (action + 1) * salt;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * turns a compiled state back into a world state for a callback that depends on variables (or everything, if it's
+ * empty), adding the start state's variables outside the domain. Must be freed with map_deinit()
+ */
+static goap_worldstate_t compiled_world(const goap_check_cache_t *cache, const map_bool_t *variables,
+                                        const goap_cond_t *view) {
+    goap_worldstate_t world = {0};
+    for (uint32_t var = 0; var < cache->domain->numVars; var++) {
+        if (goap_bits_test(&view->mask, var)) {
+            map_set(&world, goap_domain_var_name(cache->domain, var), goap_bits_test(&view->value, var));
+        }
+    }
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(&cache->fixed, &iter))) {
+        if (variables->base.nnodes == 0 || map_get_(&variables->base, key) != NULL) {
+            map_set(&world, key, *(const bool*) map_get_(&cache->fixed.base, key));
+        }
+    }
+    return world;
+}
+
+bool goap_check_compiled(goap_check_cache_t *cache, uint32_t action, const goap_cond_t *state) {
+    goap_cond_t view;
+    uint64_t hash = compiled_key(cache, action, &cache->checkRelevant[action], CHECK_SALT, state, &view);
+    uint32_t result;
+    if (goap_check_lookup(cache, hash, &result)) {
+        return result;
+    }
+    const goap_action_t *source = &cache->actions->p[action];
+    goap_worldstate_t world = compiled_world(cache, &source->checkVariables, &view);
+    result = source->checkFunction(source, &world);
+    map_deinit(&world);
+    goap_check_store(cache, hash, result);
+    return result;
+}
+
+uint32_t goap_check_cost(goap_check_cache_t *cache, uint32_t action, const goap_cond_t *state) {
+    goap_cond_t view;
+    uint64_t hash = compiled_key(cache, action, &cache->costRelevant[action], COST_SALT, state, &view);
+    uint32_t result;
+    if (goap_check_lookup(cache, hash, &result)) {
+        return result;
+    }
+    const goap_action_t *source = &cache->actions->p[action];
+    goap_worldstate_t world = compiled_world(cache, &source->costVariables, &view);
+    result = source->costFunction(source, &world);
+    map_deinit(&world);
+    // the heuristics assume the static cost is a lower bound, going under it could make them overestimate
+    if (result < source->cost) {
+        result = source->cost;
+    }
+    goap_check_store(cache, hash, result);
+    return result;
+}
@@ -0,0 +1,1596 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if !GOAP_STATIC
+#include <sys/mman.h>
+#endif
+
+DA_TYPEDEF(char, chararray_t)
+DA_TYPEDEF(uint32_t, uint32array_t)
+DA_TYPEDEF(goap_compiled_action_t, compiled_actionlist_t)
+DA_TYPEDEF(goap_cond_t, condlist_t)
+DA_TYPEDEF(goap_compiled_number_t, compiled_numberlist_t)
+
+/** a number, stored as width consecutive variables starting at first, least significant bit first */
+typedef struct {
+    uint32_t first;
+    uint32_t width;
+    /** largest value it was declared with */
+    uint32_t max;
+} number_t;
+typedef map_t(number_t) map_number_t;
+
+/** an effect that adds delta to a number */
+typedef struct {
+    number_t number;
+    int64_t delta;
+} increment_t;
+DA_TYPEDEF(increment_t, incrementlist_t)
+
+/** used while compiling to build the string table */
+typedef struct {
+    chararray_t strings;
+    /** offset of each string that's already in the table */
+    map_int_t offsets;
+    /** offset of each variable's name, indexed by bit */
+    uint32array_t varNames;
+    /** maps a variable name to its bit index */
+    map_int_t varIndex;
+    compiled_actionlist_t actions;
+    /** precondition alternatives of every action, then the goal's */
+    condlist_t alternatives;
+    /** numbers declared so far, by name, and in the order they were declared for the domain */
+    map_number_t numbers;
+    compiled_numberlist_t compiledNumbers;
+} domain_builder_t;
+
+/** returns the offset of str in the string table, adding it if it's not there yet */
+static uint32_t intern_string(domain_builder_t *builder, const char *str) {
+    int *existing = map_get(&builder->offsets, str);
+    if (existing != NULL) {
+        return *existing;
+    }
+    uint32_t offset = da_count(builder->strings);
+    da_addn(builder->strings, str, strlen(str) + 1);
+    map_set(&builder->offsets, str, offset);
+    return offset;
+}
+
+/** returns the bit index of the named variable, allocating one if it's new, or -1 if we've run out of bits */
+static int var_bit(domain_builder_t *builder, const char *name) {
+    int *existing = map_get(&builder->varIndex, name);
+    if (existing != NULL) {
+        return *existing;
+    }
+    if (da_count(builder->varNames) >= GOAP_MAX_VARS) {
+        return -1;
+    }
+    int bit = da_count(builder->varNames);
+    da_add(builder->varNames, intern_string(builder, name));
+    map_set(&builder->varIndex, name, bit);
+    return bit;
+}
+
+/** compiles a map of conditions into a goap_cond_t, returns false if we ran out of bits */
+static bool compile_conditions(domain_builder_t *builder, map_bool_t *conditions, goap_cond_t *out) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    *out = (goap_cond_t) {0};
+    while ((key = map_next(conditions, &iter))) {
+        int bit = var_bit(builder, key);
+        if (bit < 0) {
+            return false;
+        }
+        goap_bits_set(&out->mask, bit);
+        if (*map_get(conditions, key)) {
+            goap_bits_set(&out->value, bit);
+        }
+    }
+    return true;
+}
+
+/** a variable and its name, for sorting */
+typedef struct {
+    const char *name;
+    uint32_t var;
+} var_name_t;
+
+static int var_name_comparator(const void *a, const void *b) {
+    return strcmp(((const var_name_t*) a)->name, ((const var_name_t*) b)->name);
+}
+
+/** fills in the domain's sortedVars from its variable names */
+static void sort_vars(goap_domain_t *domain) {
+    if (domain->numVars == 0) {
+        return;
+    }
+    var_name_t *names = malloc(sizeof(var_name_t) * domain->numVars);
+    for (uint32_t i = 0; i < domain->numVars; i++) {
+        names[i] = (var_name_t) {goap_domain_var_name(domain, i), i};
+    }
+    qsort(names, domain->numVars, sizeof(var_name_t), var_name_comparator);
+    for (uint32_t i = 0; i < domain->numVars; i++) {
+        domain->sortedVars[i] = names[i].var;
+    }
+    free(names);
+}
+
+/**
+ * moves everything the builder made into the domain and frees the rest, or just frees it all if ok is false
+ * @return true if the domain was built
+ */
+static bool builder_finish(domain_builder_t *builder, goap_domain_t *domain, bool ok) {
+#if GOAP_STATIC
+    if (ok && (da_count(builder->actions) > GOAP_MAX_ACTIONS || da_count(builder->strings) > GOAP_MAX_STRINGS
+               || da_count(builder->alternatives) > GOAP_MAX_ALTERNATIVES)) {
+#if GOAP_DEBUG
+        fprintf(stderr, "Cannot compile domain: %zu actions and %zu bytes of names don't fit in the static limits\n",
+                da_count(builder->actions), da_count(builder->strings));
+#endif
+        ok = false;
+    }
+#endif
+    map_deinit(&builder->offsets);
+    map_deinit(&builder->numbers);
+    if (!ok) {
+        da_free(builder->strings);
+        da_free(builder->varNames);
+        da_free(builder->actions);
+        da_free(builder->alternatives);
+        da_free(builder->compiledNumbers);
+        map_deinit(&builder->varIndex);
+        return false;
+    }
+    domain->stringsSize = da_count(builder->strings);
+    domain->numVars = da_count(builder->varNames);
+    domain->numActions = da_count(builder->actions);
+    domain->numAlternatives = da_count(builder->alternatives);
+    domain->numNumbers = da_count(builder->compiledNumbers);
+#if GOAP_STATIC
+    memcpy(domain->strings, builder->strings.p, domain->stringsSize);
+    memcpy(domain->varNames, builder->varNames.p, sizeof(uint32_t) * domain->numVars);
+    memcpy(domain->actions, builder->actions.p, sizeof(goap_compiled_action_t) * domain->numActions);
+    memcpy(domain->alternatives, builder->alternatives.p, sizeof(goap_cond_t) * domain->numAlternatives);
+    memcpy(domain->numbers, builder->compiledNumbers.p, sizeof(goap_compiled_number_t) * domain->numNumbers);
+    da_free(builder->strings);
+    da_free(builder->varNames);
+    da_free(builder->actions);
+    da_free(builder->alternatives);
+    da_free(builder->compiledNumbers);
+    map_deinit(&builder->varIndex);
+#else
+    // the dynamic arrays are plain malloc'd blocks, so we can just take ownership of them
+    domain->strings = builder->strings.p;
+    domain->varNames = builder->varNames.p;
+    domain->actions = builder->actions.p;
+    domain->alternatives = builder->alternatives.p;
+    domain->numbers = builder->compiledNumbers.p;
+    domain->varIndex = builder->varIndex;
+    domain->sortedVars = malloc(sizeof(uint32_t) * domain->numVars);
+#endif
+    sort_vars(domain);
+    return true;
+}
+
+bool goap_domain_compile(goap_domain_t *domain, goap_actionlist_t actions) {
+    memset(domain, 0, sizeof(*domain));
+    domain_builder_t builder = {0};
+    bool ok = true;
+
+    for (goap_action_t *it = da_begin(actions), *end = da_end(actions); it != end; ++it) {
+        goap_compiled_action_t action = {0};
+        action.name = intern_string(&builder, it->name);
+        action.cost = it->cost;
+        if (!compile_conditions(&builder, &it->preConditions, &action.pre)
+            || !compile_conditions(&builder, &it->postConditions, &action.post)) {
+#if GOAP_DEBUG
+            fprintf(stderr, "Cannot compile domain: more than %d variables used\n", GOAP_MAX_VARS);
+#endif
+            ok = false;
+            break;
+        }
+        da_add(builder.actions, action);
+    }
+    return builder_finish(&builder, domain, ok);
+}
+
+void goap_domain_free(goap_domain_t *domain) {
+#if !GOAP_STATIC
+    if (domain->mapping != NULL) {
+        munmap(domain->mapping, domain->mappingSize);
+    } else {
+        free(domain->strings);
+        free(domain->varNames);
+        free(domain->sortedVars);
+        free(domain->actions);
+        free(domain->alternatives);
+        free(domain->numbers);
+    }
+    map_deinit(&domain->varIndex);
+#endif
+    memset(domain, 0, sizeof(*domain));
+}
+
+const char *goap_domain_action_name(const goap_domain_t *domain, uint32_t action) {
+    return domain->strings + domain->actions[action].name;
+}
+
+const char *goap_domain_var_name(const goap_domain_t *domain, uint32_t var) {
+    return domain->strings + domain->varNames[var];
+}
+
+int goap_domain_var_index(const goap_domain_t *domain, const char *name) {
+#if !GOAP_STATIC
+    if (domain->mapping == NULL) {
+        // map_get_ rather than map_get, which would write its result into the map
+        const int *bit = map_get_(&domain->varIndex.base, name);
+        return bit != NULL ? *bit : -1;
+    }
+#endif
+    // static and mapped domains don't keep a hash map, so that loading them does no work per variable. They have the
+    // variables sorted by name instead, which takes a binary search
+    uint32_t lo = 0, hi = domain->numVars;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int order = strcmp(goap_domain_var_name(domain, domain->sortedVars[mid]), name);
+        if (order == 0) {
+            return (int) domain->sortedVars[mid];
+        }
+        if (order < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+goap_dnf_t goap_domain_goal(const goap_domain_t *domain) {
+    goap_dnf_t goal;
+    goal.alternatives = domain->alternatives + domain->numAlternatives - domain->numGoalAlternatives;
+    goal.count = domain->numGoalAlternatives;
+    return goal;
+}
+
+goap_cond_t goap_domain_compile_state(const goap_domain_t *domain, goap_worldstate_t world) {
+    return goap_domain_compile_state_v2(domain, &world);
+}
+
+goap_cond_t goap_domain_compile_state_v2(const goap_domain_t *domain, const goap_worldstate_t *world) {
+    goap_cond_t out = {0};
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(world, &iter))) {
+        int bit = goap_domain_var_index(domain, key);
+        if (bit < 0) {
+            continue;
+        }
+        goap_bits_set(&out.mask, bit);
+        if (*goap_worldstate_get(world, key)) {
+            goap_bits_set(&out.value, bit);
+        }
+    }
+    return out;
+}
+
+bool goap_domain_compile_query(const goap_domain_t *domain, goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                               goap_cond_t *start, goap_cond_t *goalCond) {
+    return goap_domain_compile_query_v2(domain, &currentWorld, &goal, start, goalCond);
+}
+
+bool goap_domain_compile_query_v2(const goap_domain_t *domain, const goap_worldstate_t *currentWorld,
+                                  const goap_worldstate_t *goal, goap_cond_t *start, goap_cond_t *goalCond) {
+    *start = goap_domain_compile_state_v2(domain, currentWorld);
+    *goalCond = goap_domain_compile_state_v2(domain, goal);
+
+    // variables no action touches are constant, so they're either already satisfied or never will be
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(goal, &iter))) {
+        if (goap_domain_var_index(domain, key) >= 0) {
+            continue;
+        }
+        const bool *current = goap_worldstate_get(currentWorld, key);
+        if (current == NULL || *current != *goap_worldstate_get(goal, key)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Conditions in disjunctive normal form, as a list of alternatives. The text language compiles whole expressions
+// into these, and both languages use them for comparisons on numbers.
+
+/** returns true if a and b set the same variable to different values */
+static inline bool cond_conflicts(goap_cond_t a, goap_cond_t b) {
+    const uint64_t *aMask = goap_bits_cwords(&a.mask), *aValue = goap_bits_cwords(&a.value);
+    const uint64_t *bMask = goap_bits_cwords(&b.mask), *bValue = goap_bits_cwords(&b.value);
+    for (uint32_t i = 0; i < GOAP_STATE_WORDS; i++) {
+        if (aMask[i] & bMask[i] & (aValue[i] ^ bValue[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** returns true if every state that satisfies b also satisfies a */
+static inline bool cond_implied(goap_cond_t a, goap_cond_t b) {
+    return goap_cond_satisfied(b, a);
+}
+
+/** adds an alternative to a DNF, unless it's redundant, and drops any alternatives it makes redundant */
+static void dnf_add(condlist_t *dnf, goap_cond_t cond) {
+    for (size_t i = 0; i < da_count(*dnf); i++) {
+        if (cond_implied(dnf->p[i], cond)) {
+            return;
+        }
+    }
+    for (size_t i = da_count(*dnf); i > 0; i--) {
+        if (cond_implied(cond, dnf->p[i - 1])) {
+            da_delete(*dnf, i - 1);
+        }
+    }
+    da_add(*dnf, cond);
+}
+
+/** replaces a with a && b */
+static void dnf_and(condlist_t *a, condlist_t *b) {
+    condlist_t out = {0};
+    for (size_t i = 0; i < da_count(*a); i++) {
+        for (size_t j = 0; j < da_count(*b); j++) {
+            if (cond_conflicts(a->p[i], b->p[j])) {
+                continue;
+            }
+            // they don't conflict, so applying one to the other is their union
+            goap_cond_t both = goap_cond_apply(a->p[i], b->p[j]);
+            dnf_add(&out, both);
+        }
+    }
+    da_free(*a);
+    *a = out;
+}
+
+/** replaces a with a || b */
+static void dnf_or(condlist_t *a, condlist_t *b) {
+    for (size_t i = 0; i < da_count(*b); i++) {
+        dnf_add(a, b->p[i]);
+    }
+}
+
+/** replaces a with !a, using De Morgan's laws: each alternative becomes a disjunction of its negated variables */
+static void dnf_not(condlist_t *a) {
+    condlist_t out = {0};
+    goap_cond_t always = {0};
+    da_add(out, always);
+    for (size_t i = 0; i < da_count(*a); i++) {
+        condlist_t negated = {0};
+        const uint64_t *mask = goap_bits_cwords(&a->p[i].mask);
+        for (uint32_t word = 0; word < GOAP_STATE_WORDS; word++) {
+            for (uint64_t bits = mask[word]; bits; bits &= bits - 1) {
+                uint32_t var = word * 64 + __builtin_ctzll(bits);
+                goap_cond_t literal = {0};
+                goap_bits_set(&literal.mask, var);
+                if (!goap_bits_test(&a->p[i].value, var)) {
+                    goap_bits_set(&literal.value, var);
+                }
+                da_add(negated, literal);
+            }
+        }
+        dnf_and(&out, &negated);
+        da_free(negated);
+    }
+    da_free(*a);
+    *a = out;
+}
+
+// Streaming JSON loader. This reads the same documents as goap_parse_json(), but tokenizes them in a single pass and
+// feeds names straight into the domain builder, so no DOM or action list is ever built.
+
+/** deepest nesting of unknown values we're willing to skip over */
+#define JSON_MAX_DEPTH 64
+
+/** reads the JSON and text domain languages */
+typedef struct {
+    const char *str;
+    size_t length;
+    size_t pos;
+    /** the last string or identifier read, unescaped and NUL terminated */
+    chararray_t string;
+    goap_parse_error_t *error;
+    /** where the text language looks up variables: either the builder, which adds new ones, or an existing domain */
+    domain_builder_t *builder;
+    const goap_domain_t *domain;
+    /** where changes to numbers that depend on their current value go while reading effects, NULL otherwise */
+    incrementlist_t *increments;
+} text_reader_t;
+
+/** records an error at the current position, if there isn't one already. Always returns false. */
+static bool reader_fail(text_reader_t *reader, const char *message) {
+    if (reader->error->message == NULL) {
+        reader->error->offset = reader->pos;
+        reader->error->message = message;
+    }
+    return false;
+}
+
+static void reader_skip_whitespace(text_reader_t *reader) {
+    while (reader->pos < reader->length) {
+        char c = reader->str[reader->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+        reader->pos++;
+    }
+}
+
+/** returns the next non whitespace character without consuming it, or 0 at the end of the document */
+static char json_peek(text_reader_t *reader) {
+    reader_skip_whitespace(reader);
+    return reader->pos < reader->length ? reader->str[reader->pos] : 0;
+}
+
+static bool json_expect(text_reader_t *reader, char c, const char *message) {
+    if (json_peek(reader) != c) {
+        return reader_fail(reader, message);
+    }
+    reader->pos++;
+    return true;
+}
+
+static bool json_literal(text_reader_t *reader, const char *literal) {
+    size_t length = strlen(literal);
+    if (reader->length - reader->pos < length || memcmp(reader->str + reader->pos, literal, length) != 0) {
+        return reader_fail(reader, "invalid literal");
+    }
+    reader->pos += length;
+    return true;
+}
+
+/** reads 4 hex digits of a \u escape */
+static bool json_hex4(text_reader_t *reader, uint32_t *out) {
+    *out = 0;
+    if (reader->length - reader->pos < 4) {
+        return reader_fail(reader, "truncated unicode escape");
+    }
+    for (int i = 0; i < 4; i++) {
+        char c = reader->str[reader->pos++];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return reader_fail(reader, "invalid unicode escape");
+        }
+        *out = *out << 4 | digit;
+    }
+    return true;
+}
+
+static void json_append_utf8(text_reader_t *reader, uint32_t codepoint) {
+    char bytes[4];
+    size_t count;
+    if (codepoint < 0x80) {
+        bytes[0] = (char) codepoint;
+        count = 1;
+    } else if (codepoint < 0x800) {
+        bytes[0] = (char) (0xC0 | codepoint >> 6);
+        bytes[1] = (char) (0x80 | (codepoint & 0x3F));
+        count = 2;
+    } else if (codepoint < 0x10000) {
+        bytes[0] = (char) (0xE0 | codepoint >> 12);
+        bytes[1] = (char) (0x80 | (codepoint >> 6 & 0x3F));
+        bytes[2] = (char) (0x80 | (codepoint & 0x3F));
+        count = 3;
+    } else {
+        bytes[0] = (char) (0xF0 | codepoint >> 18);
+        bytes[1] = (char) (0x80 | (codepoint >> 12 & 0x3F));
+        bytes[2] = (char) (0x80 | (codepoint >> 6 & 0x3F));
+        bytes[3] = (char) (0x80 | (codepoint & 0x3F));
+        count = 4;
+    }
+    da_addn(reader->string, bytes, count);
+}
+
+/** reads a string into reader->string, unescaping it */
+static bool json_string(text_reader_t *reader) {
+    if (!json_expect(reader, '"', "expected a string")) {
+        return false;
+    }
+    da_clear(reader->string);
+    while (true) {
+        // copy runs of plain characters in one go
+        size_t start = reader->pos;
+        while (reader->pos < reader->length && reader->str[reader->pos] != '"' && reader->str[reader->pos] != '\\'
+               && (unsigned char) reader->str[reader->pos] >= 0x20) {
+            reader->pos++;
+        }
+        da_addn(reader->string, reader->str + start, reader->pos - start);
+        if (reader->pos >= reader->length) {
+            return reader_fail(reader, "unterminated string");
+        }
+        char c = reader->str[reader->pos++];
+        if (c == '"') {
+            break;
+        } else if (c != '\\') {
+            reader->pos--;
+            return reader_fail(reader, "control character in string");
+        }
+        if (reader->pos >= reader->length) {
+            return reader_fail(reader, "unterminated string");
+        }
+        char escaped = reader->str[reader->pos++];
+        uint32_t codepoint;
+        switch (escaped) {
+            case '"': case '\\': case '/':
+                da_add(reader->string, escaped);
+                break;
+            case 'b': da_add(reader->string, '\b'); break;
+            case 'f': da_add(reader->string, '\f'); break;
+            case 'n': da_add(reader->string, '\n'); break;
+            case 'r': da_add(reader->string, '\r'); break;
+            case 't': da_add(reader->string, '\t'); break;
+            case 'u':
+                if (!json_hex4(reader, &codepoint)) {
+                    return false;
+                }
+                if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+                    // high surrogate, which must be followed by a low one
+                    uint32_t low;
+                    if (!json_literal(reader, "\\u") || !json_hex4(reader, &low) || low < 0xDC00 || low >= 0xE000) {
+                        return reader_fail(reader, "invalid surrogate pair");
+                    }
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                json_append_utf8(reader, codepoint);
+                break;
+            default:
+                reader->pos--;
+                return reader_fail(reader, "invalid escape sequence");
+        }
+    }
+    da_add(reader->string, '\0');
+    return true;
+}
+
+static bool json_number(text_reader_t *reader, double *out) {
+    reader_skip_whitespace(reader);
+    size_t start = reader->pos;
+    const char *s = reader->str;
+    size_t end = reader->length;
+    size_t i = start;
+    if (i < end && s[i] == '-') i++;
+    size_t digits = i;
+    while (i < end && s[i] >= '0' && s[i] <= '9') i++;
+    if (i == digits) {
+        return reader_fail(reader, "expected a number");
+    }
+    if (i < end && s[i] == '.') {
+        i++;
+        size_t fraction = i;
+        while (i < end && s[i] >= '0' && s[i] <= '9') i++;
+        if (i == fraction) {
+            return reader_fail(reader, "expected digits after the decimal point");
+        }
+    }
+    if (i < end && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < end && (s[i] == '+' || s[i] == '-')) i++;
+        size_t exponent = i;
+        while (i < end && s[i] >= '0' && s[i] <= '9') i++;
+        if (i == exponent) {
+            return reader_fail(reader, "expected digits in the exponent");
+        }
+    }
+    // the document isn't necessarily NUL terminated, so give strtod a copy of just the number
+    char buffer[64];
+    if (i - start >= sizeof(buffer)) {
+        return reader_fail(reader, "number is too long");
+    }
+    memcpy(buffer, s + start, i - start);
+    buffer[i - start] = '\0';
+    *out = strtod(buffer, NULL);
+    reader->pos = i;
+    return true;
+}
+
+static bool json_bool(text_reader_t *reader, bool *out) {
+    char c = json_peek(reader);
+    *out = c == 't';
+    if (c != 't' && c != 'f') {
+        return reader_fail(reader, "expected true or false");
+    }
+    return json_literal(reader, *out ? "true" : "false");
+}
+
+/**
+ * starts reading an object or array, where open is '{' or '['
+ * @param more set to true if it has any members
+ */
+static bool json_begin(text_reader_t *reader, char open, bool *more) {
+    if (!json_expect(reader, open, open == '{' ? "expected an object" : "expected an array")) {
+        return false;
+    }
+    *more = json_peek(reader) != (open == '{' ? '}' : ']');
+    if (!*more) {
+        reader->pos++;
+    }
+    return true;
+}
+
+/** reads an object's next key into reader->string, leaving the reader at its value */
+static bool json_key(text_reader_t *reader) {
+    return json_string(reader) && json_expect(reader, ':', "expected ':'");
+}
+
+/**
+ * moves past the separator after an object or array member
+ * @param more set to true if another member follows, false if that was the end of the object or array
+ */
+static bool json_next(text_reader_t *reader, char open, bool *more) {
+    *more = json_peek(reader) == ',';
+    if (*more) {
+        reader->pos++;
+        return true;
+    }
+    if (open == '{') {
+        return json_expect(reader, '}', "expected ',' or '}'");
+    }
+    return json_expect(reader, ']', "expected ',' or ']'");
+}
+
+/** skips over a value we don't care about */
+static bool json_skip(text_reader_t *reader, int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        return reader_fail(reader, "document is nested too deeply");
+    }
+    char c = json_peek(reader);
+    double number;
+    bool more;
+    switch (c) {
+        case '"':
+            return json_string(reader);
+        case 't':
+            return json_literal(reader, "true");
+        case 'f':
+            return json_literal(reader, "false");
+        case 'n':
+            return json_literal(reader, "null");
+        case '[':
+        case '{':
+            if (!json_begin(reader, c, &more)) {
+                return false;
+            }
+            while (more) {
+                if ((c == '{' && !json_key(reader)) || !json_skip(reader, depth + 1) || !json_next(reader, c, &more)) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return json_number(reader, &number);
+    }
+}
+
+// Numbers. A number that goes up to max is stored in the bits of variables named "Name[0]", "Name[1]" and so on, least
+// significant first, so states, hashes and heuristics don't need to know about them. Comparisons compile into one
+// alternative per aligned block of values in range, and assignments into a single alternative. An increment flips
+// different bits depending on the value it starts from, so an action that adds to a number becomes one action per
+// value it could start from, with that value as a precondition.
+
+/** most bits a number may use */
+#define NUMBER_MAX_BITS 16
+/** most copies an action that changes numbers may compile into, one for each combination of their starting values */
+#define NUMBER_MAX_VARIANTS 256
+
+/** writes the name of the variable holding one of a number's bits into buffer, returns false if it doesn't fit */
+static bool number_bit_name(char *buffer, size_t size, const char *name, uint32_t bit) {
+    int length = snprintf(buffer, size, "%s[%u]", name, bit);
+    return length > 0 && (size_t) length < size;
+}
+
+/** looks up a number in a compiled domain */
+static bool domain_number(const goap_domain_t *domain, const char *name, number_t *out) {
+    for (uint32_t i = 0; i < domain->numNumbers; i++) {
+        const goap_compiled_number_t *number = &domain->numbers[i];
+        if (strcmp(domain->strings + number->name, name) == 0) {
+            *out = (number_t) {number->first, number->width, number->max};
+            return true;
+        }
+    }
+    return false;
+}
+
+/** looks up a number in the builder or domain the reader is using */
+static bool reader_number(text_reader_t *reader, const char *name, number_t *out) {
+    if (reader->builder == NULL) {
+        return domain_number(reader->domain, name, out);
+    }
+    number_t *number = map_get(&reader->builder->numbers, name);
+    if (number != NULL) {
+        *out = *number;
+    }
+    return number != NULL;
+}
+
+/** reads a whole number no bigger than max */
+static bool reader_whole_number(text_reader_t *reader, uint32_t max, uint32_t *out) {
+    double value;
+    if (!json_number(reader, &value)) {
+        return false;
+    }
+    if (value < 0 || value > max || value != (uint32_t) value) {
+        return reader_fail(reader, "expected a whole number in range");
+    }
+    *out = (uint32_t) value;
+    return true;
+}
+
+/** adds a number going from 0 to max to the builder, allocating its bits */
+static bool number_declare(text_reader_t *reader, const char *name, uint32_t max) {
+    domain_builder_t *builder = reader->builder;
+    if (max == 0 || max > (1u << NUMBER_MAX_BITS) - 1) {
+        return reader_fail(reader, "number's largest value must be between 1 and 65535");
+    }
+    if (map_get(&builder->numbers, name) != NULL) {
+        return reader_fail(reader, "number is declared more than once");
+    }
+    if (map_get(&builder->varIndex, name) != NULL) {
+        return reader_fail(reader, "number is already used as a variable");
+    }
+    number_t number = {0};
+    number.width = 32 - __builtin_clz(max);
+    number.max = max;
+    for (uint32_t i = 0; i < number.width; i++) {
+        char bitName[256];
+        if (!number_bit_name(bitName, sizeof(bitName), name, i)) {
+            return reader_fail(reader, "number's name is too long");
+        }
+        if (map_get(&builder->varIndex, bitName) != NULL) {
+            return reader_fail(reader, "number is already used as a variable");
+        }
+        int bit = var_bit(builder, bitName);
+        if (bit < 0) {
+            return reader_fail(reader, "too many variables");
+        }
+        if (i == 0) {
+            number.first = bit;
+        }
+    }
+    map_set(&builder->numbers, name, number);
+    goap_compiled_number_t compiled = {intern_string(builder, name), number.first, number.width, number.max};
+    da_add(builder->compiledNumbers, compiled);
+    return true;
+}
+
+/** returns the condition that the number holds exactly value */
+static goap_cond_t number_value(number_t number, uint32_t value) {
+    goap_cond_t cond = {0};
+    for (uint32_t bit = 0; bit < number.width; bit++) {
+        goap_bits_set(&cond.mask, number.first + bit);
+        if (value >> bit & 1) {
+            goap_bits_set(&cond.value, number.first + bit);
+        }
+    }
+    return cond;
+}
+
+/** adds alternatives to out that together hold when lo <= number <= hi */
+static void number_range(condlist_t *out, number_t number, uint64_t lo, uint64_t hi) {
+    // values above max never happen, so a range that reaches it may as well cover them too, which makes bigger blocks
+    uint64_t top = (1ull << number.width) - 1;
+    if (hi >= number.max) {
+        hi = top;
+    }
+    while (lo <= hi) {
+        // the biggest block of 2^size values that starts at lo, is aligned to its size and doesn't go past hi, which
+        // leaves the number's lowest size bits free
+        uint32_t size = 0;
+        while (size < number.width && (lo & ((2ull << size) - 1)) == 0 && lo + (2ull << size) - 1 <= hi) {
+            size++;
+        }
+        goap_cond_t block = {0};
+        for (uint32_t bit = size; bit < number.width; bit++) {
+            goap_bits_set(&block.mask, number.first + bit);
+            if (lo >> bit & 1) {
+                goap_bits_set(&block.value, number.first + bit);
+            }
+        }
+        dnf_add(out, block);
+        lo += 1ull << size;
+    }
+}
+
+/**
+ * reads the operator and value following a number's name into out. Conditions compare the number with ==, !=, <, <=,
+ * > or >=. Effects (when increments isn't NULL) set it with = or change it with += and -=, which go into increments.
+ */
+static bool number_condition(text_reader_t *reader, number_t number, condlist_t *out, incrementlist_t *increments) {
+    static const char *comparisons[] = {"==", "!=", "<=", ">=", "<", ">"};
+    static const char *effects[] = {"+=", "-=", "="};
+    const char **operators = increments != NULL ? effects : comparisons;
+    size_t numOperators = increments != NULL ? 3 : 6;
+    const char *op = NULL;
+    json_peek(reader);
+    for (size_t i = 0; i < numOperators && op == NULL; i++) {
+        size_t length = strlen(operators[i]);
+        if (reader->length - reader->pos >= length && memcmp(reader->str + reader->pos, operators[i], length) == 0) {
+            op = operators[i];
+            reader->pos += length;
+        }
+    }
+    if (op == NULL) {
+        return reader_fail(reader, increments != NULL ? "expected '=', '+=' or '-=' after a number"
+                                                      : "expected a comparison after a number");
+    }
+    uint32_t value;
+    if (!reader_whole_number(reader, increments != NULL ? number.max : UINT32_MAX, &value)) {
+        return false;
+    }
+
+    uint64_t top = (1ull << number.width) - 1;
+    if (strcmp(op, "==") == 0) {
+        number_range(out, number, value, value);
+    } else if (strcmp(op, "!=") == 0) {
+        if (value > 0) {
+            number_range(out, number, 0, value - 1);
+        }
+        number_range(out, number, (uint64_t) value + 1, top);
+    } else if (strcmp(op, "<") == 0) {
+        if (value > 0) {
+            number_range(out, number, 0, value - 1);
+        }
+    } else if (strcmp(op, "<=") == 0) {
+        number_range(out, number, 0, value);
+    } else if (strcmp(op, ">") == 0) {
+        number_range(out, number, (uint64_t) value + 1, top);
+    } else if (strcmp(op, ">=") == 0) {
+        number_range(out, number, value, top);
+    } else if (strcmp(op, "=") == 0) {
+        da_add(*out, number_value(number, value));
+    } else {
+        for (size_t i = 0; i < da_count(*increments); i++) {
+            if (increments->p[i].number.first == number.first) {
+                return reader_fail(reader, "number is changed more than once");
+            }
+        }
+        increment_t increment = {number, op[0] == '+' ? (int64_t) value : -(int64_t) value};
+        da_add(*increments, increment);
+        goap_cond_t always = {0};
+        da_add(*out, always);
+    }
+    return true;
+}
+
+/** adds an action to the builder, moving what all its precondition alternatives have in common into its pre */
+static void builder_add_alternatives(domain_builder_t *builder, goap_compiled_action_t action, const condlist_t *pre) {
+    if (da_count(*pre) == 1) {
+        action.pre = pre->p[0];
+    } else if (da_count(*pre) > 1) {
+        // pre is what all the alternatives have in common, so most actions can be ruled out with a single check
+        goap_cond_t common = pre->p[0];
+        uint64_t *commonMask = goap_bits_words(&common.mask), *commonValue = goap_bits_words(&common.value);
+        for (size_t i = 1; i < da_count(*pre); i++) {
+            const uint64_t *mask = goap_bits_cwords(&pre->p[i].mask);
+            const uint64_t *value = goap_bits_cwords(&pre->p[i].value);
+            for (uint32_t word = 0; word < GOAP_STATE_WORDS; word++) {
+                commonMask[word] &= mask[word] & ~(commonValue[word] ^ value[word]);
+            }
+        }
+        for (uint32_t word = 0; word < GOAP_STATE_WORDS; word++) {
+            commonValue[word] &= commonMask[word];
+        }
+        action.pre = common;
+        action.firstAlternative = da_count(builder->alternatives);
+        action.numAlternatives = da_count(*pre);
+        da_addn(builder->alternatives, pre->p, da_count(*pre));
+    }
+    da_add(builder->actions, action);
+}
+
+/**
+ * adds an action whose preconditions are the alternatives in pre (none means it can always run) to the reader's
+ * builder, splitting it into one copy per starting value of any numbers it changes
+ * @param start where the action starts in the document, for errors
+ */
+static bool builder_add_action(text_reader_t *reader, size_t start, goap_compiled_action_t action,
+                               const condlist_t *pre, const incrementlist_t *increments) {
+    if (da_count(*increments) == 0) {
+        builder_add_alternatives(reader->builder, action, pre);
+        return true;
+    }
+    uint64_t variants = 1;
+    for (size_t i = 0; i < da_count(*increments); i++) {
+        number_t number = increments->p[i].number;
+        for (uint32_t bit = 0; bit < number.width; bit++) {
+            if (goap_bits_test(&action.post.mask, number.first + bit)) {
+                reader->pos = start;
+                return reader_fail(reader, "number is both set and changed");
+            }
+        }
+        variants *= number.max + 1;
+        if (variants > NUMBER_MAX_VARIANTS) {
+            reader->pos = start;
+            return reader_fail(reader, "action changes numbers with too many possible values");
+        }
+    }
+
+    for (uint64_t variant = 0; variant < variants; variant++) {
+        // pick each number's starting value out of the variant, and skip it if any of them would leave their range
+        goap_cond_t values = {0};
+        goap_compiled_action_t copy = action;
+        uint64_t rest = variant;
+        bool fits = true;
+        for (size_t i = 0; i < da_count(*increments) && fits; i++) {
+            number_t number = increments->p[i].number;
+            uint32_t value = rest % (number.max + 1);
+            rest /= number.max + 1;
+            int64_t result = (int64_t) value + increments->p[i].delta;
+            fits = result >= 0 && result <= number.max;
+            values = goap_cond_apply(values, number_value(number, value));
+            copy.post = goap_cond_apply(copy.post, number_value(number, (uint32_t) result));
+        }
+        if (!fits) {
+            continue;
+        }
+        condlist_t variantPre = {0}, valueList = {0};
+        if (da_count(*pre) > 0) {
+            da_addn(variantPre, pre->p, da_count(*pre));
+        } else {
+            goap_cond_t always = {0};
+            da_add(variantPre, always);
+        }
+        da_add(valueList, values);
+        dnf_and(&variantPre, &valueList);
+        // a starting value the preconditions rule out doesn't need a copy either
+        if (da_count(variantPre) > 0) {
+            builder_add_alternatives(reader->builder, copy, &variantPre);
+        }
+        da_free(variantPre);
+        da_free(valueList);
+    }
+    return true;
+}
+
+bool goap_domain_set_number(const goap_domain_t *domain, goap_cond_t *state, const char *name, uint32_t value) {
+    number_t number;
+    if (!domain_number(domain, name, &number) || value > number.max) {
+        return false;
+    }
+    *state = goap_cond_apply(*state, number_value(number, value));
+    return true;
+}
+
+bool goap_domain_get_number(const goap_domain_t *domain, const goap_cond_t *state, const char *name,
+                            uint32_t *value) {
+    number_t number;
+    if (!domain_number(domain, name, &number)) {
+        return false;
+    }
+    *value = 0;
+    for (uint32_t bit = 0; bit < number.width; bit++) {
+        if (!goap_bits_test(&state->mask, number.first + bit)) {
+            return false;
+        }
+        if (goap_bits_test(&state->value, number.first + bit)) {
+            *value |= 1u << bit;
+        }
+    }
+    return true;
+}
+
+/**
+ * reads an object of conditions into out, as alternatives since comparisons on numbers may need several. Numbers are
+ * given either a value, or a string holding a comparison (or for effects, "+= 1" and the like).
+ * @param increments NULL when reading preconditions, otherwise where changes to numbers go
+ */
+static bool json_conditions(text_reader_t *reader, domain_builder_t *builder, condlist_t *out,
+                            incrementlist_t *increments) {
+    goap_cond_t plain = {0};
+    da_clear(*out);
+    da_add(*out, plain);
+    bool more;
+    if (!json_begin(reader, '{', &more)) {
+        return false;
+    }
+    while (more) {
+        if (!json_key(reader)) {
+            return false;
+        }
+        number_t *number = map_get(&builder->numbers, reader->string.p);
+        if (number != NULL) {
+            number_t found = *number;
+            condlist_t cond = {0};
+            size_t valueStart = reader->pos;
+            bool ok;
+            if (json_peek(reader) == '"') {
+                // the comparison is read with a reader of its own, and any problem with it is reported at the string
+                goap_parse_error_t error = {0};
+                text_reader_t comparison = {0};
+                ok = json_string(reader);
+                comparison.str = reader->string.p;
+                comparison.length = ok ? da_count(reader->string) - 1 : 0;
+                comparison.error = &error;
+                ok = ok && number_condition(&comparison, found, &cond, increments)
+                     && (json_peek(&comparison) == 0 || reader_fail(&comparison, "expected the end of the string"));
+                if (!ok && error.message != NULL) {
+                    reader->pos = valueStart;
+                    reader_skip_whitespace(reader);
+                    reader_fail(reader, error.message);
+                }
+                da_free(comparison.string);
+            } else {
+                uint32_t value;
+                ok = reader_whole_number(reader, found.max, &value);
+                if (ok && increments != NULL) {
+                    // an effect assigns exactly that value, like "= value" in the text language
+                    da_add(cond, number_value(found, value));
+                } else if (ok) {
+                    number_range(&cond, found, value, value);
+                }
+            }
+            if (ok) {
+                dnf_and(out, &cond);
+            }
+            da_free(cond);
+            if (!ok) {
+                return false;
+            }
+        } else {
+            int bit = var_bit(builder, reader->string.p);
+            if (bit < 0) {
+                return reader_fail(reader, "too many variables");
+            }
+            bool value;
+            if (!json_bool(reader, &value)) {
+                return false;
+            }
+            goap_bits_set(&plain.mask, bit);
+            if (value) {
+                goap_bits_set(&plain.value, bit);
+            } else {
+                goap_bits_clear(&plain.value, bit);
+            }
+        }
+        if (!json_next(reader, '{', &more)) {
+            return false;
+        }
+    }
+    // numbers and plain variables never share bits, so the plain ones can't conflict with any alternative
+    for (size_t i = 0; i < da_count(*out); i++) {
+        out->p[i] = goap_cond_apply(out->p[i], plain);
+    }
+    return true;
+}
+
+static bool json_action(text_reader_t *reader, domain_builder_t *builder) {
+    goap_compiled_action_t action = {0};
+    condlist_t pre = {0}, post = {0};
+    incrementlist_t increments = {0};
+    bool hasName = false, hasCost = false, hasPre = false, hasPost = false;
+    size_t start = reader->pos;
+    bool more;
+    bool ok = json_begin(reader, '{', &more);
+    while (ok && more) {
+        if (!json_key(reader)) {
+            ok = false;
+            break;
+        }
+        const char *key = reader->string.p;
+        if (strcmp(key, "name") == 0) {
+            ok = hasName = json_string(reader);
+            if (ok) {
+                action.name = intern_string(builder, reader->string.p);
+            }
+        } else if (strcmp(key, "cost") == 0) {
+            double cost;
+            ok = hasCost = json_number(reader, &cost);
+            if (ok && (cost < 0 || cost > UINT32_MAX)) {
+                ok = reader_fail(reader, "action cost is out of range");
+            }
+            action.cost = (uint32_t) cost;
+        } else if (strcmp(key, "preConditions") == 0) {
+            ok = hasPre = json_conditions(reader, builder, &pre, NULL);
+        } else if (strcmp(key, "postConditions") == 0) {
+            da_clear(increments);
+            ok = hasPost = json_conditions(reader, builder, &post, &increments);
+        } else {
+            ok = json_skip(reader, 0);
+        }
+        ok = ok && json_next(reader, '{', &more);
+    }
+    if (ok && (!hasName || !hasCost || !hasPre || !hasPost)) {
+        // report the missing field at the start of the action it's missing from
+        reader->pos = start;
+        reader_skip_whitespace(reader);
+        ok = reader_fail(reader, !hasName ? "action name doesn't exist" : !hasCost ? "action cost doesn't exist"
+                               : !hasPre ? "action preConditions doesn't exist"
+                               : "action postConditions doesn't exist");
+    }
+    if (ok) {
+        // effects only ever assign, so they're always a single alternative
+        action.post = post.p[0];
+        ok = builder_add_action(reader, start, action, &pre, &increments);
+    }
+    da_free(pre);
+    da_free(post);
+    da_free(increments);
+    return ok;
+}
+
+/** reads the object of numbers a document declares, mapping each name to its largest value */
+static bool json_numbers(text_reader_t *reader) {
+    bool more;
+    if (!json_begin(reader, '{', &more)) {
+        return false;
+    }
+    while (more) {
+        // reading the value leaves the string alone, so the key is still there to declare
+        uint32_t max;
+        if (!json_key(reader) || !reader_whole_number(reader, UINT32_MAX, &max)
+            || !number_declare(reader, reader->string.p, max) || !json_next(reader, '{', &more)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool json_document(text_reader_t *reader, domain_builder_t *builder) {
+    bool hasActions = false, more;
+    if (!json_begin(reader, '{', &more)) {
+        return false;
+    }
+    while (more) {
+        if (!json_key(reader)) {
+            return false;
+        }
+        if (strcmp(reader->string.p, "numbers") == 0) {
+            if (!json_numbers(reader)) {
+                return false;
+            }
+        } else if (strcmp(reader->string.p, "actions") == 0) {
+            hasActions = true;
+            bool moreActions;
+            if (!json_begin(reader, '[', &moreActions)) {
+                return false;
+            }
+            while (moreActions) {
+                if (!json_action(reader, builder) || !json_next(reader, '[', &moreActions)) {
+                    return false;
+                }
+            }
+        } else if (!json_skip(reader, 0)) {
+            return false;
+        }
+        if (!json_next(reader, '{', &more)) {
+            return false;
+        }
+    }
+    if (!hasActions) {
+        return reader_fail(reader, "actions array doesn't exist");
+    }
+    if (json_peek(reader) != 0) {
+        return reader_fail(reader, "unexpected data after the document");
+    }
+    return true;
+}
+
+bool goap_domain_load_json(goap_domain_t *domain, const char *str, size_t length, goap_parse_error_t *error) {
+    memset(domain, 0, sizeof(*domain));
+    goap_parse_error_t dummyError;
+    if (error == NULL) {
+        error = &dummyError;
+    }
+    memset(error, 0, sizeof(*error));
+    text_reader_t reader = {0};
+    reader.str = str;
+    reader.length = length;
+    reader.error = error;
+    domain_builder_t builder = {0};
+    reader.builder = &builder;
+
+    bool ok = json_document(&reader, &builder);
+    da_free(reader.string);
+#if GOAP_DEBUG
+    if (!ok) {
+        fprintf(stderr, "Failed to load JSON domain: %s at byte %zu\n", error->message, error->offset);
+    }
+#endif
+    return builder_finish(&builder, domain, ok);
+}
+
+// Text domain language, see docs/Language.txt. Each line is a "key: value" pair, and every action starts with a name
+// line. Expressions are compiled straight into disjunctive normal form: each sub-expression becomes a list of
+// alternatives, && takes the cross product of its operands' alternatives and || concatenates them.
+
+/** most alternatives an expression may have once it's in disjunctive normal form */
+#define EXPR_MAX_ALTERNATIVES 64
+
+static bool expr_or(text_reader_t *reader, condlist_t *out, int depth);
+
+static bool expr_is_identifier(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/** reads an identifier into reader->string */
+static bool expr_identifier(text_reader_t *reader) {
+    reader_skip_whitespace(reader);
+    size_t start = reader->pos;
+    while (reader->pos < reader->length && expr_is_identifier(reader->str[reader->pos])) {
+        reader->pos++;
+    }
+    if (reader->pos == start) {
+        return reader_fail(reader, "expected a variable");
+    }
+    da_clear(reader->string);
+    da_addn(reader->string, reader->str + start, reader->pos - start);
+    da_add(reader->string, '\0');
+    return true;
+}
+
+static bool expr_primary(text_reader_t *reader, condlist_t *out, int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        return reader_fail(reader, "expression is nested too deeply");
+    }
+    char c = json_peek(reader);
+    if (c == '!') {
+        reader->pos++;
+        if (!expr_primary(reader, out, depth + 1)) {
+            return false;
+        }
+        dnf_not(out);
+        return true;
+    }
+    if (c == '(') {
+        reader->pos++;
+        return expr_or(reader, out, depth + 1) && json_expect(reader, ')', "expected ')'");
+    }
+    size_t start = reader->pos;
+    if (!expr_identifier(reader)) {
+        return false;
+    }
+    if (strcmp(reader->string.p, "__SPEC") == 0) {
+        // a speculative effect, which we can't plan around, so it's as good as nothing
+        if (!json_expect(reader, '(', "expected '('")) {
+            return false;
+        }
+        for (int nesting = 1; nesting > 0; reader->pos++) {
+            if (reader->pos >= reader->length) {
+                return reader_fail(reader, "expected ')'");
+            }
+            nesting += reader->str[reader->pos] == '(' ? 1 : reader->str[reader->pos] == ')' ? -1 : 0;
+        }
+        goap_cond_t always = {0};
+        da_add(*out, always);
+        return true;
+    }
+    number_t number;
+    if (reader_number(reader, reader->string.p, &number)) {
+        return number_condition(reader, number, out, reader->increments);
+    }
+    int bit = reader->builder != NULL ? var_bit(reader->builder, reader->string.p)
+                                      : goap_domain_var_index(reader->domain, reader->string.p);
+    if (bit < 0) {
+        reader->pos = start;
+        return reader_fail(reader, reader->builder != NULL ? "too many variables" : "unknown variable");
+    }
+    goap_cond_t literal = {0};
+    goap_bits_set(&literal.mask, bit);
+    goap_bits_set(&literal.value, bit);
+    da_add(*out, literal);
+    return true;
+}
+
+/** returns true if the next token is the given two character operator, consuming it */
+static bool expr_operator(text_reader_t *reader, const char *op) {
+    if (json_peek(reader) != op[0] || reader->pos + 1 >= reader->length || reader->str[reader->pos + 1] != op[1]) {
+        return false;
+    }
+    reader->pos += 2;
+    return true;
+}
+
+static bool expr_and(text_reader_t *reader, condlist_t *out, int depth) {
+    if (!expr_primary(reader, out, depth)) {
+        return false;
+    }
+    while (expr_operator(reader, "&&")) {
+        condlist_t rhs = {0};
+        bool ok = expr_primary(reader, &rhs, depth);
+        if (ok) {
+            dnf_and(out, &rhs);
+        }
+        da_free(rhs);
+        if (!ok) {
+            return false;
+        }
+        if (da_count(*out) > EXPR_MAX_ALTERNATIVES) {
+            return reader_fail(reader, "expression has too many alternatives");
+        }
+    }
+    return true;
+}
+
+static bool expr_or(text_reader_t *reader, condlist_t *out, int depth) {
+    if (!expr_and(reader, out, depth)) {
+        return false;
+    }
+    while (expr_operator(reader, "||")) {
+        condlist_t rhs = {0};
+        bool ok = expr_and(reader, &rhs, depth);
+        if (ok) {
+            dnf_or(out, &rhs);
+        }
+        da_free(rhs);
+        if (!ok) {
+            return false;
+        }
+        if (da_count(*out) > EXPR_MAX_ALTERNATIVES) {
+            return reader_fail(reader, "expression has too many alternatives");
+        }
+    }
+    return true;
+}
+
+/** compiles the rest of the reader's input as an expression. An empty expression is always true. */
+static bool expr_compile(text_reader_t *reader, condlist_t *out) {
+    da_clear(*out);
+    if (json_peek(reader) == 0) {
+        goap_cond_t always = {0};
+        da_add(*out, always);
+        return true;
+    }
+    if (!expr_or(reader, out, 0)) {
+        return false;
+    }
+    if (json_peek(reader) != 0) {
+        return reader_fail(reader, "expected '&&', '||' or the end of the line");
+    }
+    return true;
+}
+
+/** an action whose lines are still being read */
+typedef struct {
+    goap_compiled_action_t action;
+    /** where its name line starts, for errors */
+    size_t start;
+    bool hasCost;
+    condlist_t pre;
+    incrementlist_t increments;
+} text_action_t;
+
+/** adds the action that's been read to the builder */
+static bool text_finish_action(text_reader_t *reader, text_action_t *current) {
+    if (!current->hasCost) {
+        reader->pos = current->start;
+        return reader_fail(reader, "action has no cost");
+    }
+    return builder_add_action(reader, current->start, current->action, &current->pre, &current->increments);
+}
+
+static bool text_document(text_reader_t *reader, condlist_t *goal, bool *hasGoal) {
+    size_t documentLength = reader->length;
+    text_action_t current = {0};
+    bool inAction = false, ok = true;
+    condlist_t expr = {0};
+
+    for (size_t lineStart = 0; ok && lineStart < documentLength;) {
+        // find the end of the line, and cut off any comment
+        size_t lineEnd = lineStart;
+        while (lineEnd < documentLength && reader->str[lineEnd] != '\n') {
+            lineEnd++;
+        }
+        size_t contentEnd = lineStart;
+        while (contentEnd < lineEnd && reader->str[contentEnd] != '#'
+               && !(reader->str[contentEnd] == '/' && contentEnd + 1 < lineEnd && reader->str[contentEnd + 1] == '/')) {
+            contentEnd++;
+        }
+        reader->pos = lineStart;
+        reader->length = contentEnd;
+        size_t next = lineEnd + 1;
+        if (json_peek(reader) == 0) {
+            lineStart = next;
+            continue;
+        }
+
+        size_t keyStart = reader->pos;
+        while (reader->pos < reader->length && reader->str[reader->pos] != ':') {
+            reader->pos++;
+        }
+        if (reader->pos >= reader->length) {
+            reader->pos = keyStart;
+            ok = reader_fail(reader, "expected 'key: value'");
+            break;
+        }
+        size_t keyEnd = reader->pos++;
+        while (keyEnd > keyStart && (reader->str[keyEnd - 1] == ' ' || reader->str[keyEnd - 1] == '\t')) {
+            keyEnd--;
+        }
+        da_clear(reader->string);
+        da_addn(reader->string, reader->str + keyStart, keyEnd - keyStart);
+        da_add(reader->string, '\0');
+        const char *key = reader->string.p;
+
+        if (strcmp(key, "name") == 0) {
+            if (inAction && !(ok = text_finish_action(reader, &current))) {
+                break;
+            }
+            da_clear(current.pre);
+            da_clear(current.increments);
+            memset(&current.action, 0, sizeof(current.action));
+            current.hasCost = false;
+            current.start = keyStart;
+            inAction = true;
+            // names run to the end of the line, minus any trailing whitespace
+            reader_skip_whitespace(reader);
+            size_t nameEnd = reader->length;
+            while (nameEnd > reader->pos && (reader->str[nameEnd - 1] == ' ' || reader->str[nameEnd - 1] == '\t'
+                                             || reader->str[nameEnd - 1] == '\r')) {
+                nameEnd--;
+            }
+            da_clear(reader->string);
+            da_addn(reader->string, reader->str + reader->pos, nameEnd - reader->pos);
+            da_add(reader->string, '\0');
+            current.action.name = intern_string(reader->builder, reader->string.p);
+        } else if (strcmp(key, "goal") == 0) {
+            if (*hasGoal) {
+                reader->pos = keyStart;
+                ok = reader_fail(reader, "document has more than one goal");
+            } else if ((ok = expr_compile(reader, goal)) && da_count(*goal) == 0) {
+                reader->pos = keyStart;
+                ok = reader_fail(reader, "goal can never be true");
+            }
+            *hasGoal = true;
+        } else if (strcmp(key, "number") == 0) {
+            // "number: Name max" declares a number that holds 0 to max
+            uint32_t max;
+            json_peek(reader);
+            size_t nameStart = reader->pos;
+            if ((ok = expr_identifier(reader))) {
+                char *name = strdup(reader->string.p);
+                if ((ok = reader_whole_number(reader, UINT32_MAX, &max)) && json_peek(reader) != 0) {
+                    ok = reader_fail(reader, "expected the end of the line");
+                }
+                if (ok) {
+                    reader->pos = nameStart;
+                    ok = number_declare(reader, name, max);
+                }
+                free(name);
+            }
+        } else if (!inAction) {
+            reader->pos = keyStart;
+            ok = reader_fail(reader, "expected 'name:' to start an action");
+        } else if (strcmp(key, "cost") == 0) {
+            double cost;
+            if ((ok = json_number(reader, &cost))) {
+                if (cost < 0 || cost > UINT32_MAX) {
+                    ok = reader_fail(reader, "action cost is out of range");
+                } else if (json_peek(reader) != 0) {
+                    ok = reader_fail(reader, "expected the end of the line");
+                }
+                current.action.cost = (uint32_t) cost;
+                current.hasCost = true;
+            }
+        } else if (strcmp(key, "preConditions") == 0) {
+            if ((ok = expr_compile(reader, &current.pre)) && da_count(current.pre) == 0) {
+                reader->pos = keyStart;
+                ok = reader_fail(reader, "preConditions can never be true");
+            }
+        } else if (strcmp(key, "postConditions") == 0) {
+            // an effect has to be a single alternative, since the planner needs to know exactly what happens
+            da_clear(current.increments);
+            reader->increments = &current.increments;
+            ok = expr_compile(reader, &expr);
+            reader->increments = NULL;
+            if (ok && da_count(expr) != 1) {
+                reader->pos = keyStart;
+                ok = reader_fail(reader, "postConditions must only use && and !");
+            }
+            if (ok) {
+                current.action.post = expr.p[0];
+            }
+        } else {
+            reader->pos = keyStart;
+            ok = reader_fail(reader, "unknown key");
+        }
+        lineStart = next;
+    }
+    reader->length = documentLength;
+    if (ok && inAction) {
+        ok = text_finish_action(reader, &current);
+    }
+    da_free(current.pre);
+    da_free(current.increments);
+    da_free(expr);
+    return ok;
+}
+
+bool goap_domain_load_text(goap_domain_t *domain, const char *str, size_t length, goap_dnf_t *goal,
+                           goap_parse_error_t *error) {
+    memset(domain, 0, sizeof(*domain));
+    goap_parse_error_t dummyError;
+    if (error == NULL) {
+        error = &dummyError;
+    }
+    memset(error, 0, sizeof(*error));
+    text_reader_t reader = {0};
+    reader.str = str;
+    reader.length = length;
+    reader.error = error;
+    domain_builder_t builder = {0};
+    reader.builder = &builder;
+
+    condlist_t goalAlternatives = {0};
+    bool hasGoal = false;
+    bool ok = text_document(&reader, &goalAlternatives, &hasGoal);
+    // the goal goes after every action's alternatives, so it ends up in the domain too
+    uint32_t goalStart = da_count(builder.alternatives);
+    if (da_count(goalAlternatives) > 0) {
+        da_addn(builder.alternatives, goalAlternatives.p, da_count(goalAlternatives));
+    }
+    da_free(goalAlternatives);
+    da_free(reader.string);
+#if GOAP_DEBUG
+    if (!ok) {
+        fprintf(stderr, "Failed to load text domain: %s at byte %zu\n", error->message, error->offset);
+    }
+#endif
+    if (!builder_finish(&builder, domain, ok)) {
+        return false;
+    }
+    domain->numGoalAlternatives = hasGoal ? domain->numAlternatives - goalStart : 0;
+    if (goal != NULL) {
+        *goal = goap_domain_goal(domain);
+    }
+    return true;
+}
+
+bool goap_domain_compile_expression(const goap_domain_t *domain, const char *expression, goap_cond_t *alternatives,
+                                    size_t capacity, size_t *count, goap_parse_error_t *error) {
+    goap_parse_error_t dummyError;
+    if (error == NULL) {
+        error = &dummyError;
+    }
+    memset(error, 0, sizeof(*error));
+    text_reader_t reader = {0};
+    reader.str = expression;
+    reader.length = strlen(expression);
+    reader.error = error;
+    reader.domain = domain;
+
+    condlist_t dnf = {0};
+    bool ok = expr_compile(&reader, &dnf);
+    *count = ok ? da_count(dnf) : 0;
+    if (ok && *count > capacity) {
+        ok = reader_fail(&reader, "expression has more alternatives than the buffer can hold");
+    }
+    if (ok && *count > 0) {
+        memcpy(alternatives, dnf.p, sizeof(goap_cond_t) * *count);
+    }
+    da_free(dnf);
+    da_free(reader.string);
+    return ok;
+}
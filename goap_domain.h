@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include "goap.h"
+
+// A compiled domain is an action list with every variable name replaced by a bit index, so that world states,
+// preconditions and post conditions become a pair of bitmasks, and checking or applying an action is a few
+// instructions instead of a series of hash map lookups. Domains with more than 64 variables need GOAP_MAX_VARS raised,
+// in which case states span several words and the checks use SSE2 or AVX2 where the compiler targets them.
+
+/** Plan length IDA* allows for when no workspace or maxDepth is given */
+#define GOAP_IDASTAR_DEFAULT_DEPTH 32
+/**
+ * Maximum number of variables a domain can have, each one is a bit in a goap_bits_t. With the default of 64 a state is
+ * a single machine word, larger values make it an array of words (so 128, 256 and 512 are the natural sizes).
+ */
+#ifndef GOAP_MAX_VARS
+#define GOAP_MAX_VARS 64
+#endif
+/** Number of 64 bit words in a goap_bits_t */
+#define GOAP_STATE_WORDS ((GOAP_MAX_VARS + 63) / 64)
+/**
+ * If true, the best first searches store each node as the action that reached it rather than a copy of its state, see
+ * GOAP_SNAPSHOT_INTERVAL. That only saves memory once states are wider than a word, and GOAP_STATIC sizes its node
+ * arrays for the worst case anyway, so it's off otherwise.
+ */
+#ifndef GOAP_DELTA_STATES
+#define GOAP_DELTA_STATES (GOAP_STATE_WORDS > 1 && !GOAP_STATIC)
+#endif
+#if GOAP_DELTA_STATES && GOAP_STATIC
+#error "GOAP_DELTA_STATES needs the heap, so it can't be used with GOAP_STATIC"
+#endif
+#if GOAP_STATIC
+// Capacity limits for the static build profile. Everything the compiled planner needs at runtime is sized by these
+// at compile time, and a search that would need more returns GOAP_PLAN_BUDGET_EXCEEDED instead of allocating.
+/** Maximum number of actions in a compiled domain */
+#ifndef GOAP_MAX_ACTIONS
+#define GOAP_MAX_ACTIONS 128
+#endif
+/** Maximum number of nodes a best first search may generate, this also sizes its open list and closed table */
+#ifndef GOAP_MAX_NODES
+#define GOAP_MAX_NODES 4096
+#endif
+/** Size of a compiled domain's string table in bytes */
+#ifndef GOAP_MAX_STRINGS
+#define GOAP_MAX_STRINGS ((GOAP_MAX_ACTIONS + GOAP_MAX_VARS) * 32)
+#endif
+/** Maximum number of precondition alternatives a compiled domain can have, see goap_compiled_action_t */
+#ifndef GOAP_MAX_ALTERNATIVES
+#define GOAP_MAX_ALTERNATIVES (GOAP_MAX_ACTIONS * 2)
+#endif
+/** Size of the workspace IDA* uses when the caller doesn't provide one, in bytes */
+#ifndef GOAP_IDASTAR_STATIC_WORKSPACE
+#define GOAP_IDASTAR_STATIC_WORKSPACE 16384
+#endif
+#endif
+/** Returned by the heuristics when the goal can't be reached from a state at all */
+#define GOAP_HEURISTIC_INFINITY UINT32_MAX
+
+_Static_assert(GOAP_MAX_VARS > 0, "GOAP_MAX_VARS must be positive");
+
+#if GOAP_STATE_WORDS == 1
+typedef uint64_t goap_bits_t;
+#else
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+/** A set of GOAP_MAX_VARS bits: bit i is bit i % 64 of words[i / 64] */
+typedef struct {
+    uint64_t words[GOAP_STATE_WORDS];
+} goap_bits_t;
+#endif
+
+/** Returns the 64 bit words making up a goap_bits_t, whichever representation it has */
+static inline uint64_t *goap_bits_words(goap_bits_t *bits) {
+    return (uint64_t*) bits;
+}
+
+static inline const uint64_t *goap_bits_cwords(const goap_bits_t *bits) {
+    return (const uint64_t*) bits;
+}
+
+static inline void goap_bits_set(goap_bits_t *bits, uint32_t bit) {
+    goap_bits_words(bits)[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static inline void goap_bits_clear(goap_bits_t *bits, uint32_t bit) {
+    goap_bits_words(bits)[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+}
+
+static inline bool goap_bits_test(const goap_bits_t *bits, uint32_t bit) {
+    return (goap_bits_cwords(bits)[bit / 64] >> (bit % 64)) & 1;
+}
+
+/** A (partial) compiled world state: variables whose bit is set in mask are known, with their value in value */
+typedef struct {
+    goap_bits_t mask;
+    goap_bits_t value;
+} goap_cond_t;
+
+/** A condition in disjunctive normal form, which is satisfied if any of its alternatives is */
+typedef struct {
+    const goap_cond_t *alternatives;
+    uint32_t count;
+} goap_dnf_t;
+
+typedef struct {
+    /** offset of the action's name in the domain's string table */
+    uint32_t name;
+    uint32_t cost;
+    /**
+     * variables that must hold for the action to run. If the action has a disjunctive precondition, this is just the
+     * part every alternative has in common, and one of the alternatives must hold as well.
+     */
+    goap_cond_t pre;
+    goap_cond_t post;
+    /** the action's precondition alternatives in the domain's alternatives array, if numAlternatives isn't 0 */
+    uint32_t firstAlternative;
+    uint32_t numAlternatives;
+} goap_compiled_action_t;
+
+/** One of a domain's small integers, whose bits are the consecutive variables "Name[0]", "Name[1]" and so on */
+typedef struct {
+    /** offset of the number's name in the domain's string table */
+    uint32_t name;
+    /** variable holding its least significant bit, and how many bits it has */
+    uint32_t first;
+    uint32_t width;
+    /** the largest value it was declared with, which may be less than its bits can hold */
+    uint32_t max;
+} goap_compiled_number_t;
+
+typedef struct goap_domain_t {
+#if GOAP_STATIC
+    char strings[GOAP_MAX_STRINGS];
+    uint32_t varNames[GOAP_MAX_VARS];
+    uint32_t sortedVars[GOAP_MAX_VARS];
+    goap_compiled_action_t actions[GOAP_MAX_ACTIONS];
+    goap_cond_t alternatives[GOAP_MAX_ALTERNATIVES];
+    // every number has at least one bit, so there can't be more of them than variables
+    goap_compiled_number_t numbers[GOAP_MAX_VARS];
+#else
+    /** every name used by the domain, each one NUL terminated, stored once */
+    char *strings;
+    /** offset of each variable's name in the string table, indexed by bit */
+    uint32_t *varNames;
+    /** every variable's bit index, in order of their names, so that names can be looked up without a hash map */
+    uint32_t *sortedVars;
+    /** the actions, in the same order as the action list they were compiled from */
+    goap_compiled_action_t *actions;
+    /** every action's precondition alternatives */
+    goap_cond_t *alternatives;
+    /** the numbers the domain file declared */
+    goap_compiled_number_t *numbers;
+    /** maps a variable name to its bit index */
+    map_int_t varIndex;
+    /** if the domain was loaded by goap_load_binary(), the file mapping the arrays above point into */
+    void *mapping;
+    size_t mappingSize;
+#endif
+    uint32_t stringsSize;
+    uint32_t numVars;
+    uint32_t numActions;
+    uint32_t numAlternatives;
+    /** the last this many alternatives are the goal given in the domain file, if any */
+    uint32_t numGoalAlternatives;
+    uint32_t numNumbers;
+} goap_domain_t;
+
+/** Where and why loading a domain from text failed */
+typedef struct {
+    /** byte offset into the document */
+    size_t offset;
+    /** description of the problem, a string literal */
+    const char *message;
+} goap_parse_error_t;
+
+/** Scratch space for evaluating a heuristic, so that evaluating it doesn't allocate */
+typedef struct {
+    const goap_domain_t *domain;
+    goap_heuristic_t type;
+    /** goap_domain_words() of the domain */
+    uint32_t words;
+    /** estimated cost of making each literal (variable * 2 + value) true */
+    uint32_t *literalCost;
+    /** cheapest action achieving each literal, for h_FF */
+    uint32_t *supporter;
+    /** used by h_FF to extract the relaxed plan: a literal stack, and a flag per action then per literal */
+    uint32_t *stack;
+    uint8_t *inPlan;
+    /** the block the arrays live in, if goap_heuristic_init() allocated it */
+    void *allocation;
+} goap_heuristic_ctx_t;
+
+/** An entry of a goap_check_cache_t */
+typedef struct {
+    /** hash of the key, 0 marks an empty slot */
+    uint64_t hash;
+    /** where the key's bytes are in the cache's key storage */
+    size_t offset;
+    uint32_t size;
+    uint32_t value;
+} goap_check_entry_t;
+
+/**
+ * The results of the actions' callbacks (goap_action_t.checkFunction and costFunction) during one planning call, keyed
+ * by the action, which callback it is and the values of the variables the callback depends on, so each one runs once
+ * per distinct state of those. Whole keys are kept and compared, so two states with the same hash never share a result.
+ */
+typedef struct {
+    const goap_actionlist_t *actions;
+    const goap_domain_t *domain;
+    /** false if none of the actions have a callback, in which case nothing else is set up */
+    bool enabled;
+    /** for compiled searches, the variables each action's checkFunction and costFunction depend on */
+    goap_bits_t *checkRelevant;
+    goap_bits_t *costRelevant;
+    /** for compiled searches, the start state's variables that aren't in the domain, which no state can change */
+    goap_worldstate_t fixed;
+    /** open addressing table of results */
+    goap_check_entry_t *entries;
+    uint32_t size;
+    uint32_t count;
+    /** every stored key, one after another, followed by the one goap_check_key() is building */
+    uint8_t *keys;
+    size_t keysSize;
+    size_t keysCapacity;
+    size_t pendingSize;
+} goap_check_cache_t;
+
+/**
+ * Returns how many words of a goap_bits_t the domain's variables occupy. The words after them are always zero, so the
+ * functions below that take a word count only need to look at this many. With GOAP_MAX_VARS of 64 this is the
+ * constant 1, and the compiler folds the word loops away.
+ */
+static inline uint32_t goap_domain_words(const goap_domain_t *domain) {
+#if GOAP_STATE_WORDS == 1
+    (void) domain;
+    return 1;
+#else
+    return (domain->numVars + 63) / 64;
+#endif
+}
+
+/** Returns true if the first words of state satisfy every known variable of cond */
+static inline bool goap_cond_satisfied_n(const goap_cond_t *state, const goap_cond_t *cond, uint32_t words) {
+    const uint64_t *stateMask = goap_bits_cwords(&state->mask), *stateValue = goap_bits_cwords(&state->value);
+    const uint64_t *condMask = goap_bits_cwords(&cond->mask), *condValue = goap_bits_cwords(&cond->value);
+    uint32_t i = 0;
+#if GOAP_STATE_WORDS >= 4 && defined(__AVX2__)
+    for (; i + 4 <= words; i += 4) {
+        __m256i mask = _mm256_loadu_si256((const __m256i*) (condMask + i));
+        __m256i missing = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*) (stateMask + i)), mask);
+        __m256i wrong = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (stateValue + i)),
+                                         _mm256_loadu_si256((const __m256i*) (condValue + i)));
+        __m256i bad = _mm256_or_si256(missing, _mm256_and_si256(wrong, mask));
+        if (!_mm256_testz_si256(bad, bad)) {
+            return false;
+        }
+    }
+#endif
+#if GOAP_STATE_WORDS >= 2 && defined(__SSE2__)
+    for (; i + 2 <= words; i += 2) {
+        __m128i mask = _mm_loadu_si128((const __m128i*) (condMask + i));
+        __m128i missing = _mm_andnot_si128(_mm_loadu_si128((const __m128i*) (stateMask + i)), mask);
+        __m128i wrong = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (stateValue + i)),
+                                      _mm_loadu_si128((const __m128i*) (condValue + i)));
+        __m128i bad = _mm_or_si128(missing, _mm_and_si128(wrong, mask));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+    for (; i < words; i++) {
+        if ((~stateMask[i] & condMask[i]) | ((stateValue[i] ^ condValue[i]) & condMask[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Sets the variables in effect on the first words of state, in place */
+static inline void goap_cond_apply_n(goap_cond_t *state, const goap_cond_t *effect, uint32_t words) {
+    uint64_t *stateMask = goap_bits_words(&state->mask), *stateValue = goap_bits_words(&state->value);
+    const uint64_t *effectMask = goap_bits_cwords(&effect->mask), *effectValue = goap_bits_cwords(&effect->value);
+    uint32_t i = 0;
+#if GOAP_STATE_WORDS >= 4 && defined(__AVX2__)
+    for (; i + 4 <= words; i += 4) {
+        __m256i mask = _mm256_loadu_si256((const __m256i*) (effectMask + i));
+        __m256i value = _mm256_loadu_si256((const __m256i*) (effectValue + i));
+        __m256i *outMask = (__m256i*) (stateMask + i), *outValue = (__m256i*) (stateValue + i);
+        _mm256_storeu_si256(outMask, _mm256_or_si256(_mm256_loadu_si256(outMask), mask));
+        _mm256_storeu_si256(outValue, _mm256_or_si256(_mm256_andnot_si256(mask, _mm256_loadu_si256(outValue)),
+                                                      _mm256_and_si256(value, mask)));
+    }
+#endif
+#if GOAP_STATE_WORDS >= 2 && defined(__SSE2__)
+    for (; i + 2 <= words; i += 2) {
+        __m128i mask = _mm_loadu_si128((const __m128i*) (effectMask + i));
+        __m128i value = _mm_loadu_si128((const __m128i*) (effectValue + i));
+        __m128i *outMask = (__m128i*) (stateMask + i), *outValue = (__m128i*) (stateValue + i);
+        _mm_storeu_si128(outMask, _mm_or_si128(_mm_loadu_si128(outMask), mask));
+        _mm_storeu_si128(outValue, _mm_or_si128(_mm_andnot_si128(mask, _mm_loadu_si128(outValue)),
+                                                _mm_and_si128(value, mask)));
+    }
+#endif
+    for (; i < words; i++) {
+        stateMask[i] |= effectMask[i];
+        stateValue[i] = (stateValue[i] & ~effectMask[i]) | (effectValue[i] & effectMask[i]);
+    }
+}
+
+/** Returns true if the first words of a and b are identical */
+static inline bool goap_cond_equal_n(const goap_cond_t *a, const goap_cond_t *b, uint32_t words) {
+    const uint64_t *aMask = goap_bits_cwords(&a->mask), *aValue = goap_bits_cwords(&a->value);
+    const uint64_t *bMask = goap_bits_cwords(&b->mask), *bValue = goap_bits_cwords(&b->value);
+    uint64_t diff = 0;
+    for (uint32_t i = 0; i < words; i++) {
+        diff |= (aMask[i] ^ bMask[i]) | (aValue[i] ^ bValue[i]);
+    }
+    return diff == 0;
+}
+
+/** Mixes the first words of a state into a hash, which still needs finalising before its low bits are any good */
+static inline uint64_t goap_cond_hash_n(const goap_cond_t *state, uint32_t words) {
+    const uint64_t *mask = goap_bits_cwords(&state->mask), *value = goap_bits_cwords(&state->value);
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < words; i++) {
+        hash = (hash * 0xff51afd7ed558ccdULL) ^ (mask[i] * 0x9e3779b97f4a7c15ULL ^ value[i]);
+    }
+    return hash;
+}
+
+/** Returns true if the state satisfies every known variable of cond */
+static inline bool goap_cond_satisfied(goap_cond_t state, goap_cond_t cond) {
+    return goap_cond_satisfied_n(&state, &cond, GOAP_STATE_WORDS);
+}
+
+/** Returns true if the first words of state satisfy any of the alternatives */
+static inline bool goap_dnf_satisfied_n(const goap_cond_t *state, goap_dnf_t dnf, uint32_t words) {
+    for (uint32_t i = 0; i < dnf.count; i++) {
+        if (goap_cond_satisfied_n(state, &dnf.alternatives[i], words)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Returns true if the state satisfies any of the alternatives */
+static inline bool goap_dnf_satisfied(goap_cond_t state, goap_dnf_t dnf) {
+    return goap_dnf_satisfied_n(&state, dnf, GOAP_STATE_WORDS);
+}
+
+/** Returns true if the action can run in the given state, words is goap_domain_words() */
+static inline bool goap_action_applicable(const goap_domain_t *domain, const goap_compiled_action_t *action,
+                                          const goap_cond_t *state, uint32_t words) {
+    if (!goap_cond_satisfied_n(state, &action->pre, words)) {
+        return false;
+    }
+    if (action->numAlternatives == 0) {
+        return true;
+    }
+    goap_dnf_t alternatives = {domain->alternatives + action->firstAlternative, action->numAlternatives};
+    return goap_dnf_satisfied_n(state, alternatives, words);
+}
+
+/** Returns the state after setting the variables in effect */
+static inline goap_cond_t goap_cond_apply(goap_cond_t state, goap_cond_t effect) {
+    goap_cond_apply_n(&state, &effect, GOAP_STATE_WORDS);
+    return state;
+}
+
+/**
+ * Compiles an action list. Fails if the actions use more than GOAP_MAX_VARS variables, or with GOAP_STATIC, if
+ * they don't fit in the domain's other fixed size arrays. Compiling uses the heap for temporary storage even with
+ * GOAP_STATIC, only planning with the compiled domain is guaranteed not to.
+ * @return true on success, in which case the domain must be freed with goap_domain_free()
+ */
+bool goap_domain_compile(goap_domain_t *domain, goap_actionlist_t actions);
+/** Frees everything owned by the domain */
+void goap_domain_free(goap_domain_t *domain);
+/**
+ * Loads a domain straight from a JSON action list in the same format goap_parse_json() reads. The document is read in
+ * a single pass without building a DOM or an action list, so this is much faster for large domains. The document may
+ * also declare small integers in a "numbers" object (such as {"Ammo": 7}, which holds 0 to 7) before its actions.
+ * Conditions give these either a value or a comparison string like ">= 2", and effects a value or "+= 1" or "-= 1".
+ * @param error if not NULL, receives the location of the first problem with the document on failure
+ * @return true on success, in which case the domain must be freed with goap_domain_free()
+ */
+bool goap_domain_load_json(goap_domain_t *domain, const char *str, size_t length, goap_parse_error_t *error);
+/**
+ * Loads a domain written in the text language sketched in docs/Language.txt. Preconditions and goals may be any
+ * expression using &&, || and ! (in that order of precedence, with parentheses), and are compiled into disjunctive
+ * normal form. Post conditions must be a conjunction of variables, optionally negated. Anything inside __SPEC(...)
+ * is a speculative effect the planner can't rely on, so it's ignored. Lines like "number: Ammo 7" declare a small
+ * integer, which conditions compare with ==, !=, <, <=, > and >= and effects change with =, += and -=.
+ * @param goal if not NULL, receives the file's goal expression, if it has one (otherwise the count is 0). Its
+ * alternatives live in the domain, so it stays valid until the domain is freed.
+ * @param error if not NULL, receives the location of the first problem with the document on failure
+ * @return true on success, in which case the domain must be freed with goap_domain_free()
+ */
+bool goap_domain_load_text(goap_domain_t *domain, const char *str, size_t length, goap_dnf_t *goal,
+                           goap_parse_error_t *error);
+/**
+ * Compiles an expression in the same language as goap_domain_load_text() against an existing domain, for example a
+ * goal chosen at runtime. Fails if the expression uses a variable the domain doesn't know about.
+ * @param alternatives buffer that receives the expression in disjunctive normal form
+ * @param capacity number of entries the buffer can hold
+ * @param count receives the number of alternatives
+ */
+bool goap_domain_compile_expression(const goap_domain_t *domain, const char *expression, goap_cond_t *alternatives,
+                                    size_t capacity, size_t *count, goap_parse_error_t *error);
+/**
+ * Sets one of the domain's numbers in a compiled state, such as the start state of a plan. Numbers are stored in the
+ * bits of variables named "Name[0]", "Name[1]" and so on, least significant first.
+ * @return false if the domain has no such number, or the value is larger than the one it was declared with
+ */
+bool goap_domain_set_number(const goap_domain_t *domain, goap_cond_t *state, const char *name, uint32_t value);
+/**
+ * Reads one of the domain's numbers out of a compiled state.
+ * @return false if the domain has no such number, or the state doesn't know all of its bits
+ */
+bool goap_domain_get_number(const goap_domain_t *domain, const goap_cond_t *state, const char *name,
+                            uint32_t *value);
+/**
+ * Loads a JSON (if the path ends in .json) or text domain file through an on-disk cache of compiled domains. If the
+ * cache holds a compiled copy of the file with the same contents, it's mapped with goap_load_binary() and the file
+ * isn't parsed at all. Otherwise, the file is parsed and the cache entry is (re)written, so entries for files that
+ * have changed are replaced automatically. Cache entries are written atomically, so several processes may share a
+ * cache directory.
+ * @param cacheDir directory to keep the cache in, which must already exist, or NULL to just parse the file
+ * @param error if not NULL, receives the location of the first problem with the file if it couldn't be parsed
+ * @return true on success, in which case the domain must be freed with goap_domain_free()
+ */
+bool goap_domain_load_cached(goap_domain_t *domain, const char *path, const char *cacheDir, goap_parse_error_t *error);
+/** Returns the goal given in the domain file, which has no alternatives if there wasn't one */
+goap_dnf_t goap_domain_goal(const goap_domain_t *domain);
+/**
+ * Writes a compiled domain to disk in the binary format goap_load_binary() reads, see goap_binary.c for the layout.
+ * @return true on success
+ */
+bool goap_domain_save_binary(const goap_domain_t *domain, const char *path);
+/** Returns the name of the given action */
+const char *goap_domain_action_name(const goap_domain_t *domain, uint32_t action);
+/** Returns the name of the given variable */
+const char *goap_domain_var_name(const goap_domain_t *domain, uint32_t var);
+/** Returns the bit index of the named variable, or -1 if the domain doesn't use it */
+int goap_domain_var_index(const goap_domain_t *domain, const char *name);
+/** Compiles a world state, leaving out any variables the domain doesn't know about */
+goap_cond_t goap_domain_compile_state(const goap_domain_t *domain, goap_worldstate_t world);
+/** Same as goap_domain_compile_state(), but takes the world state by pointer */
+goap_cond_t goap_domain_compile_state_v2(const goap_domain_t *domain, const goap_worldstate_t *world);
+/**
+ * Compiles the world states of a planning query. Variables that no action mentions are left out of start, since
+ * they can never change. If the goal mentions such a variable, it can only be reached if the current world already
+ * agrees with it, otherwise this returns false.
+ */
+bool goap_domain_compile_query(const goap_domain_t *domain, goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                               goap_cond_t *start, goap_cond_t *goalCond);
+/** Same as goap_domain_compile_query(), but takes the world states by pointer */
+bool goap_domain_compile_query_v2(const goap_domain_t *domain, const goap_worldstate_t *currentWorld,
+                                  const goap_worldstate_t *goal, goap_cond_t *start, goap_cond_t *goalCond);
+
+/**
+ * Plans over a compiled domain using options->search, which must be one of the best first strategies (anything other
+ * than GOAP_SEARCH_DFS). Unlike the depth first search, actions may appear in the plan more than once.
+ * @param options search settings, or NULL for A* with no heuristic
+ * @param stats if not NULL, filled with information about the search
+ * @param plan buffer that receives the indices of the plan's actions, in order
+ * @param capacity number of entries the plan buffer can hold
+ * @param length receives the number of actions in the plan, which may exceed capacity if GOAP_PLAN_TOO_LONG is
+ * returned
+ */
+goap_plan_status_t goap_domain_plan(const goap_domain_t *domain, goap_cond_t start, goap_cond_t goal,
+                                   const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                   uint32_t *plan, size_t capacity, size_t *length);
+/** Same as goap_domain_plan(), but the plan may reach any of the goal's alternatives */
+goap_plan_status_t goap_domain_plan_dnf(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                       const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                       uint32_t *plan, size_t capacity, size_t *length);
+/**
+ * Same as goap_domain_plan_dnf(), but a plan too long for the buffer is still returned rather than searched for again:
+ * if overflow isn't NULL, it's pointed at a buffer from malloc() that holds the whole plan (which must be freed with
+ * free()), and GOAP_PLAN_FOUND is returned. Otherwise it's left NULL and the plan is in the given buffer as usual.
+ */
+goap_plan_status_t goap_domain_plan_dnf_ex(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                          const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                          uint32_t *plan, size_t capacity, size_t *length, uint32_t **overflow);
+
+/** Returns the suboptimality bound a search strategy guarantees with the given heuristic and weight */
+float goap_search_quality_bound(goap_search_t strategy, goap_heuristic_t heuristic, float weight);
+/**
+ * Plans with iterative deepening A*. This is what goap_domain_plan_dnf_ex() calls for GOAP_SEARCH_IDASTAR, see there
+ * for the parameters. Everything the search needs lives in options->workspace, so it never allocates (unless an action
+ * has a checkFunction or costFunction, whose results are cached on the heap). If a branch is cut off because the
+ * workspace or maxDepth doesn't allow for anything longer, a plan that's found anyway has no suboptimality bound, and
+ * if none is found, GOAP_PLAN_BUDGET_EXCEEDED is returned.
+ */
+goap_plan_status_t goap_idastar_plan(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                     const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                     uint32_t *plan, size_t capacity, size_t *length, uint32_t **overflow);
+/** Returns the workspace size IDA* needs to find plans of up to maxDepth actions on this domain */
+size_t goap_idastar_workspace_size(const goap_domain_t *domain, uint32_t maxDepth, uint32_t transpositionEntries);
+
+/**
+ * Sets up a cache of callback results for one planning call, free with goap_check_free().
+ * @param domain the domain compiled from actions, or NULL if the search isn't over a compiled domain
+ * @param actions the action list, or NULL if there are no callbacks to run
+ * @param startWorld for a compiled domain, the start state, whose variables outside the domain are passed to the
+ * callbacks as they are. May be NULL.
+ */
+void goap_check_init(goap_check_cache_t *cache, const goap_domain_t *domain, const goap_actionlist_t *actions,
+                     const goap_worldstate_t *startWorld);
+void goap_check_free(goap_check_cache_t *cache);
+/** Returns true if the action has a procedural precondition that still has to pass */
+static inline bool goap_check_needed(const goap_check_cache_t *cache, uint32_t action) {
+    return cache->enabled && cache->actions->p[action].checkFunction != NULL;
+}
+/** Returns true if the action's cost depends on the state, so goap_check_cost() has to be asked for it */
+static inline bool goap_cost_needed(const goap_check_cache_t *cache, uint32_t action) {
+    return cache->enabled && cache->actions->p[action].costFunction != NULL;
+}
+/**
+ * Returns the result of the action's procedural precondition in a compiled state, only calling it if it hasn't seen
+ * the same values of its checkVariables before. The world state it's given holds the state's variables, and the start
+ * state's ones the domain doesn't have.
+ */
+bool goap_check_compiled(goap_check_cache_t *cache, uint32_t action, const goap_cond_t *state);
+/** Same as goap_check_compiled(), for the action's costFunction. Never returns less than the action's static cost. */
+uint32_t goap_check_cost(goap_check_cache_t *cache, uint32_t action, const goap_cond_t *state);
+/**
+ * Starts a key of size bytes and returns where to write it, for goap_check_lookup() and goap_check_store(). The key
+ * must hold everything the result depends on: the action, which callback it's for and the state it sees.
+ */
+void *goap_check_key(goap_check_cache_t *cache, size_t size);
+/** Looks up the result cached under the key goap_check_key() started, which has the given hash, false if none */
+bool goap_check_lookup(const goap_check_cache_t *cache, uint64_t hash, uint32_t *result);
+/** Caches a result under the key goap_check_key() started, which has the given hash */
+void goap_check_store(goap_check_cache_t *cache, uint64_t hash, uint32_t result);
+
+/** Returns the number of bytes of scratch space a heuristic needs for the domain */
+size_t goap_heuristic_scratch_size(const goap_domain_t *domain);
+/**
+ * Allocates scratch space to evaluate the given heuristic on the domain, free with goap_heuristic_free().
+ * With GOAP_STATIC this uses a static buffer instead, so only one heuristic can be in use at a time.
+ */
+void goap_heuristic_init(goap_heuristic_ctx_t *ctx, const goap_domain_t *domain, goap_heuristic_t type);
+/**
+ * Sets up a heuristic to use the given buffer as its scratch space, which must be at least
+ * goap_heuristic_scratch_size() bytes and stay alive as long as the heuristic is used. Nothing needs to be freed.
+ */
+void goap_heuristic_init_buffer(goap_heuristic_ctx_t *ctx, const goap_domain_t *domain, goap_heuristic_t type,
+                                void *buffer);
+void goap_heuristic_free(goap_heuristic_ctx_t *ctx);
+/**
+ * Estimates the cost of reaching goal from state using the delete relaxation: actions are assumed to never make a
+ * variable lose a value it already had. Does not allocate, so it's fine to call at every node. Each call works out
+ * the literal costs from scratch rather than from the parent node's, since a child can make literals dearer as well
+ * as cheaper: a fixpoint that sweeps every action's preconditions until nothing gets cheaper, so one evaluation costs
+ * O(actions * passes), where passes is one more than the longest chain of actions in the relaxed plan. h_FF then
+ * walks back over the relaxed plan, which is O(literals).
+ * @return the estimate, or GOAP_HEURISTIC_INFINITY if the goal can't be reached even in the relaxed problem
+ */
+uint32_t goap_heuristic_eval(goap_heuristic_ctx_t *ctx, goap_cond_t state, goap_cond_t goal);
+/** Same as goap_heuristic_eval(), but estimates the cost of the cheapest of the goal's alternatives */
+uint32_t goap_heuristic_eval_dnf(goap_heuristic_ctx_t *ctx, goap_cond_t state, goap_dnf_t goal);
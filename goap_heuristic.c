@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdlib.h>
+
+// The delete relaxation heuristics. Each variable/value pair is a "literal" (index var * 2 + value), and in the
+// relaxed problem a literal stays true forever once it's been achieved. We compute the cost of achieving every literal
+// with a Bellman-Ford style fixpoint over the actions, then combine the costs of the goal literals.
+
+#define NO_ACTION UINT32_MAX
+
+/** iterates over the bits set in the first words of mask, with var being the index of each one */
+#define BITS_ITER(mask, words, var) \
+    for (uint32_t _word = 0; _word < (words); _word++) \
+        for (uint64_t _bits = goap_bits_cwords(&(mask))[_word]; \
+             _bits && ((var) = _word * 64 + __builtin_ctzll(_bits), 1); _bits &= _bits - 1)
+
+static inline uint32_t literal(uint32_t var, const goap_bits_t *value) {
+    return var * 2 + (uint32_t) goap_bits_test(value, var);
+}
+
+static inline uint32_t saturating_add(uint32_t a, uint32_t b) {
+    uint64_t sum = (uint64_t) a + b;
+    return sum >= GOAP_HEURISTIC_INFINITY ? GOAP_HEURISTIC_INFINITY - 1 : (uint32_t) sum;
+}
+
+/** combines the costs of the literals in cond, either by max or sum */
+static uint32_t cond_cost(goap_heuristic_ctx_t *ctx, goap_cond_t cond, bool sum) {
+    uint32_t total = 0, var;
+    BITS_ITER(cond.mask, ctx->words, var) {
+        uint32_t cost = ctx->literalCost[literal(var, &cond.value)];
+        if (cost == GOAP_HEURISTIC_INFINITY) {
+            return GOAP_HEURISTIC_INFINITY;
+        }
+        if (sum) {
+            total = saturating_add(total, cost);
+        } else if (cost > total) {
+            total = cost;
+        }
+    }
+    return total;
+}
+
+/** returns the cheapest alternative of a disjunction, and its cost in *cost */
+static goap_cond_t dnf_cheapest(goap_heuristic_ctx_t *ctx, goap_dnf_t dnf, bool sum, uint32_t *cost) {
+    goap_cond_t best = {0};
+    *cost = GOAP_HEURISTIC_INFINITY;
+    for (uint32_t i = 0; i < dnf.count; i++) {
+        uint32_t altCost = cond_cost(ctx, dnf.alternatives[i], sum);
+        if (altCost < *cost) {
+            *cost = altCost;
+            best = dnf.alternatives[i];
+        }
+    }
+    return best;
+}
+
+/** returns the literals needed to run the action (its cheapest alternative, if it has several), and their cost */
+static goap_cond_t action_pre(goap_heuristic_ctx_t *ctx, const goap_compiled_action_t *action, bool sum,
+                              uint32_t *cost) {
+    if (action->numAlternatives == 0) {
+        *cost = cond_cost(ctx, action->pre, sum);
+        return action->pre;
+    }
+    // every alternative includes the common part in pre, so that doesn't need counting separately
+    goap_dnf_t alternatives = {ctx->domain->alternatives + action->firstAlternative, action->numAlternatives};
+    return dnf_cheapest(ctx, alternatives, sum, cost);
+}
+
+size_t goap_heuristic_scratch_size(const goap_domain_t *domain) {
+    size_t numLiterals = domain->numVars * 2 + 1;
+    return sizeof(uint32_t) * numLiterals * 3 + domain->numActions + numLiterals;
+}
+
+void goap_heuristic_init_buffer(goap_heuristic_ctx_t *ctx, const goap_domain_t *domain, goap_heuristic_t type,
+                                void *buffer) {
+    size_t numLiterals = domain->numVars * 2 + 1;
+    ctx->domain = domain;
+    ctx->type = type;
+    ctx->words = goap_domain_words(domain);
+    ctx->literalCost = buffer;
+    ctx->supporter = ctx->literalCost + numLiterals;
+    ctx->stack = ctx->supporter + numLiterals;
+    ctx->inPlan = (uint8_t*) (ctx->stack + numLiterals);
+    ctx->allocation = NULL;
+}
+
+#if GOAP_STATIC
+/** enough scratch space for the largest domain the static limits allow, see goap_heuristic_scratch_size() */
+static uint32_t staticScratch[(GOAP_MAX_VARS * 2 + 1) * 4 + GOAP_MAX_ACTIONS / 4 + 1];
+
+void goap_heuristic_init(goap_heuristic_ctx_t *ctx, const goap_domain_t *domain, goap_heuristic_t type) {
+    goap_heuristic_init_buffer(ctx, domain, type, staticScratch);
+}
+#else
+void goap_heuristic_init(goap_heuristic_ctx_t *ctx, const goap_domain_t *domain, goap_heuristic_t type) {
+    void *buffer = malloc(goap_heuristic_scratch_size(domain));
+    goap_heuristic_init_buffer(ctx, domain, type, buffer);
+    ctx->allocation = buffer;
+}
+#endif
+
+void goap_heuristic_free(goap_heuristic_ctx_t *ctx) {
+    free(ctx->allocation);
+    ctx->allocation = NULL;
+}
+
+/** h_FF: walks back from the goal through the cheapest supporters and adds up the cost of the actions it used */
+static uint32_t relaxed_plan_cost(goap_heuristic_ctx_t *ctx, goap_cond_t goal) {
+    const goap_domain_t *domain = ctx->domain;
+    // inPlan holds one flag per action, followed by one "already pushed" flag per literal
+    uint8_t *pushed = ctx->inPlan + domain->numActions;
+    memset(ctx->inPlan, 0, domain->numActions + domain->numVars * 2);
+    uint32_t sp = 0, total = 0, var;
+
+    BITS_ITER(goal.mask, ctx->words, var) {
+        uint32_t lit = literal(var, &goal.value);
+        pushed[lit] = 1;
+        ctx->stack[sp++] = lit;
+    }
+    while (sp > 0) {
+        uint32_t lit = ctx->stack[--sp];
+        uint32_t action = ctx->supporter[lit];
+        if (action == NO_ACTION || ctx->inPlan[action]) {
+            // either already true in the state, or already paid for
+            continue;
+        }
+        ctx->inPlan[action] = 1;
+        total = saturating_add(total, domain->actions[action].cost);
+        uint32_t preCost;
+        goap_cond_t pre = action_pre(ctx, &domain->actions[action], true, &preCost);
+        BITS_ITER(pre.mask, ctx->words, var) {
+            uint32_t preLit = literal(var, &pre.value);
+            if (!pushed[preLit]) {
+                pushed[preLit] = 1;
+                ctx->stack[sp++] = preLit;
+            }
+        }
+    }
+    return total;
+}
+
+uint32_t goap_heuristic_eval(goap_heuristic_ctx_t *ctx, goap_cond_t state, goap_cond_t goal) {
+    goap_dnf_t dnf = {&goal, 1};
+    return goap_heuristic_eval_dnf(ctx, state, dnf);
+}
+
+uint32_t goap_heuristic_eval_dnf(goap_heuristic_ctx_t *ctx, goap_cond_t state, goap_dnf_t goal) {
+    if (ctx->type == GOAP_HEURISTIC_NONE || goap_dnf_satisfied_n(&state, goal, ctx->words)) {
+        return 0;
+    }
+    const goap_domain_t *domain = ctx->domain;
+    uint32_t numLiterals = domain->numVars * 2, var;
+    bool sum = ctx->type != GOAP_HEURISTIC_MAX;
+
+    for (uint32_t i = 0; i < numLiterals; i++) {
+        ctx->literalCost[i] = GOAP_HEURISTIC_INFINITY;
+        ctx->supporter[i] = NO_ACTION;
+    }
+    BITS_ITER(state.mask, ctx->words, var) {
+        ctx->literalCost[literal(var, &state.value)] = 0;
+    }
+
+    // relax until no literal gets any cheaper. costs only ever go down, so this terminates. the cost tables can't
+    // alias the actions, which saves reloading them after every store to a table
+    const goap_compiled_action_t *restrict actions = domain->actions;
+    const uint32_t numActions = domain->numActions;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 0; i < numActions; i++) {
+            const goap_compiled_action_t *action = &actions[i];
+            uint32_t preCost;
+            action_pre(ctx, action, sum, &preCost);
+            if (preCost == GOAP_HEURISTIC_INFINITY) {
+                continue;
+            }
+            uint32_t cost = saturating_add(preCost, action->cost);
+            BITS_ITER(action->post.mask, ctx->words, var) {
+                uint32_t lit = literal(var, &action->post.value);
+                if (cost < ctx->literalCost[lit]) {
+                    ctx->literalCost[lit] = cost;
+                    ctx->supporter[lit] = i;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    uint32_t goalCost;
+    goap_cond_t cheapestGoal = dnf_cheapest(ctx, goal, sum, &goalCost);
+    if (goalCost == GOAP_HEURISTIC_INFINITY || ctx->type != GOAP_HEURISTIC_FF) {
+        return goalCost;
+    }
+    return relaxed_plan_cost(ctx, cheapestGoal);
+}
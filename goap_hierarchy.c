@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compound actions. The top-level search plans with a compound action's own conditions and cost, which for a sequence
+// summarise its steps, and it's only turned into the actions it's made of when it's about to run. Since that's done
+// against the world state at the time, the refinement can't be thrown off by anything that changed while the rest of
+// the plan ran, and actions that aren't going to run are never refined at all.
+
+goap_action_t *goap_actionlist_find(const goap_actionlist_t *list, const char *name) {
+    for (size_t i = 0; i < da_count(*list); i++) {
+        if (strcmp(list->p[i].name, name) == 0) {
+            return &list->p[i];
+        }
+    }
+    return NULL;
+}
+
+bool goap_action_summarise(goap_action_t *action, const goap_actionlist_t *allActions) {
+    goap_worldstate_t pre = {0}, post = {0};
+    uint64_t cost = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < da_count(action->subActions); i++) {
+        const goap_action_t *step = goap_actionlist_find(allActions, action->subActions.p[i]);
+        if (step == NULL || step == action) {
+#if GOAP_DEBUG
+            fprintf(stderr, "Compound action %s has an invalid step %s\n", action->name, action->subActions.p[i]);
+#endif
+            ok = false;
+            break;
+        }
+        map_iter_t iter = map_iter();
+        const char *key = NULL;
+        while (ok && (key = map_next(&step->preConditions, &iter))) {
+            bool value = *goap_worldstate_get(&step->preConditions, key);
+            // whatever an earlier step set is what this one gets, otherwise it's up to the world the sequence starts in
+            const bool *set = goap_worldstate_get(&post, key);
+            const bool *needed = goap_worldstate_get(&pre, key);
+            if (set != NULL || needed != NULL) {
+                ok = *(set != NULL ? set : needed) == value;
+            } else {
+                map_set(&pre, key, value);
+            }
+        }
+        iter = map_iter();
+        while (ok && (key = map_next(&step->postConditions, &iter))) {
+            map_set(&post, key, *goap_worldstate_get(&step->postConditions, key));
+        }
+        cost += step->cost;
+#if GOAP_DEBUG
+        if (!ok) {
+            fprintf(stderr, "Compound action %s can never run, its steps disagree about %s\n", action->name, key);
+        }
+#endif
+    }
+    if (!ok) {
+        map_deinit(&pre);
+        map_deinit(&post);
+        return false;
+    }
+    map_deinit(&action->preConditions);
+    map_deinit(&action->postConditions);
+    action->preConditions = pre;
+    action->postConditions = post;
+    action->cost = cost > UINT32_MAX ? UINT32_MAX : (uint32_t) cost;
+    return true;
+}
+
+/** checks that a sequence's steps can run in order from the world state, and returns them, or an empty list if not */
+static goap_actionlist_t refine_sequence(const goap_action_t *action, const goap_worldstate_t *currentWorld,
+                                         const goap_actionlist_t *allActions, goap_plan_stats_t *stats) {
+    goap_actionlist_t steps = {0};
+    goap_worldstate_t world = goap_worldstate_clone_v2(currentWorld);
+    stats->status = GOAP_PLAN_FOUND;
+    for (size_t i = 0; i < da_count(action->subActions); i++) {
+        const goap_action_t *step = goap_actionlist_find(allActions, action->subActions.p[i]);
+        if (step == NULL || !goap_worldstate_compare_v2(&world, &step->preConditions)) {
+#if GOAP_DEBUG
+            fprintf(stderr, "Cannot refine %s: step %s can't run\n", action->name, action->subActions.p[i]);
+#endif
+            stats->status = GOAP_PLAN_NOT_FOUND;
+            stats->planCost = 0;
+            da_clear(steps);
+            break;
+        }
+        map_iter_t iter = map_iter();
+        const char *key = NULL;
+        while ((key = map_next(&step->postConditions, &iter))) {
+            map_set(&world, key, *goap_worldstate_get(&step->postConditions, key));
+        }
+        stats->planCost += step->cost;
+        da_add(steps, *step);
+    }
+    map_deinit(&world);
+    return steps;
+}
+
+goap_actionlist_t goap_planner_refine(const goap_action_t *action, const goap_worldstate_t *currentWorld,
+                                      const goap_actionlist_t *allActions, const goap_planner_options_t *options,
+                                      goap_plan_stats_t *stats) {
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    uint64_t start = goap_time_us();
+    memset(stats, 0, sizeof(*stats));
+    goap_actionlist_t refined = {0};
+
+    if (da_count(action->subActions) == 0 || action->sequence) {
+        if (action->sequence) {
+            refined = refine_sequence(action, currentWorld, allActions, stats);
+        } else {
+            stats->status = GOAP_PLAN_FOUND;
+            stats->planCost = action->cost;
+            da_add(refined, *action);
+        }
+        stats->suboptimalityBound = 1.0f;
+        stats->elapsedUs = goap_time_us() - start;
+    } else {
+        // the sub-plan may use internal actions, that's what they're there for, but the copies are searched as if
+        // they were ordinary ones
+        goap_actionlist_t candidates = {0};
+        for (size_t i = 0; i < da_count(action->subActions); i++) {
+            const goap_action_t *subAction = goap_actionlist_find(allActions, action->subActions.p[i]);
+            if (subAction != NULL) {
+                goap_action_t candidate = *subAction;
+                candidate.internal = false;
+                da_add(candidates, candidate);
+            }
+        }
+        refined = goap_planner_plan_v2(currentWorld, &action->postConditions, &candidates, options, stats);
+        da_free(candidates);
+    }
+    return refined;
+}
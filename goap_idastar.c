@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Iterative deepening A*: repeated depth first searches that give up on any node whose f = g + h exceeds a bound,
+// raising the bound to the smallest f that was cut off each time around. Only the current path is kept, as a stack of
+// frames, so memory use is linear in the plan length. The optional transposition table remembers the cheapest g each
+// state was reached with during the current iteration, and skips states we've already searched from more cheaply.
+//
+// The workspace is laid out as: heuristic scratch space, then the frame stack, then the transposition table.
+
+#define WORKSPACE_ALIGN 16
+#define NO_ACTION UINT32_MAX
+
+typedef struct {
+    goap_cond_t state;
+    uint32_t g;
+    /** action that took us here from the previous frame */
+    uint32_t action;
+    /** next action to try from this frame */
+    uint32_t next;
+} ida_frame_t;
+
+typedef struct {
+    goap_cond_t state;
+    uint32_t g;
+    /** iteration the entry was written in, entries from older iterations are ignored */
+    uint32_t iteration;
+} ida_entry_t;
+
+#if GOAP_STATIC
+/** used when the caller doesn't give us a workspace */
+static _Alignas(WORKSPACE_ALIGN) uint8_t staticWorkspace[GOAP_IDASTAR_STATIC_WORKSPACE];
+#endif
+
+static size_t align_up(size_t size) {
+    return (size + WORKSPACE_ALIGN - 1) & ~(size_t) (WORKSPACE_ALIGN - 1);
+}
+
+size_t goap_idastar_workspace_size(const goap_domain_t *domain, uint32_t maxDepth, uint32_t transpositionEntries) {
+    return align_up(goap_heuristic_scratch_size(domain)) + align_up(sizeof(ida_frame_t) * ((size_t) maxDepth + 1))
+           + sizeof(ida_entry_t) * transpositionEntries;
+}
+
+static inline size_t entry_index(const goap_cond_t *state, uint32_t words, uint32_t entries) {
+    uint64_t hash = goap_cond_hash_n(state, words);
+    hash = (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9ULL;
+    return (hash ^ (hash >> 32)) % entries;
+}
+
+/** returns true if the state is already on the path leading to frames[depth] */
+static bool on_path(ida_frame_t *frames, uint32_t depth, const goap_cond_t *state, uint32_t words) {
+    for (uint32_t i = 0; i <= depth; i++) {
+        if (goap_cond_equal_n(&frames[i].state, state, words)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+goap_plan_status_t goap_idastar_plan(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                     const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                     uint32_t *plan, size_t capacity, size_t *length, uint32_t **overflow) {
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    memset(stats, 0, sizeof(*stats));
+    uint64_t startTime = goap_time_us();
+    *length = 0;
+    stats->suboptimalityBound = goap_search_quality_bound(GOAP_SEARCH_IDASTAR, options->heuristic, 1.0f);
+
+    // work out how much of the workspace goes where, allocating one up front if the caller didn't give us one
+    uint32_t entries = options->transpositionEntries;
+    size_t fixedSize = align_up(goap_heuristic_scratch_size(domain)) + sizeof(ida_entry_t) * entries;
+    uint8_t *workspace = options->workspace;
+    size_t workspaceSize = options->workspaceSize;
+    void *allocation = NULL;
+    if (workspace == NULL) {
+#if GOAP_STATIC
+        workspace = staticWorkspace;
+        workspaceSize = sizeof(staticWorkspace);
+#else
+        uint32_t depth = options->maxDepth > 0 ? options->maxDepth : GOAP_IDASTAR_DEFAULT_DEPTH;
+        workspaceSize = goap_idastar_workspace_size(domain, depth, entries);
+        workspace = allocation = malloc(workspaceSize);
+#endif
+    }
+    if (workspaceSize < fixedSize + align_up(sizeof(ida_frame_t) * 2)) {
+#if GOAP_DEBUG
+        fprintf(stderr, "IDA* workspace of %zu bytes is too small for this domain\n", workspaceSize);
+#endif
+        stats->status = GOAP_PLAN_BUDGET_EXCEEDED;
+        free(allocation);
+        return GOAP_PLAN_BUDGET_EXCEEDED;
+    }
+    uint32_t maxDepth = (workspaceSize - fixedSize) / sizeof(ida_frame_t) - 1;
+    if (options->maxDepth > 0 && options->maxDepth < maxDepth) {
+        maxDepth = options->maxDepth;
+    }
+    goap_heuristic_ctx_t heuristic;
+    goap_heuristic_init_buffer(&heuristic, domain, options->heuristic, workspace);
+    ida_frame_t *frames = (ida_frame_t*) (workspace + align_up(goap_heuristic_scratch_size(domain)));
+    ida_entry_t *table = (ida_entry_t*) ((uint8_t*) frames + align_up(sizeof(ida_frame_t) * ((size_t) maxDepth + 1)));
+    for (uint32_t i = 0; i < entries; i++) {
+        table[i].iteration = 0;
+    }
+
+#if !GOAP_STATIC
+    goap_check_cache_t checks;
+    goap_check_init(&checks, domain, options->actions, options->startWorld);
+#endif
+
+    // from here on, nothing allocates, unless an action has a callback whose results need caching
+    const goap_compiled_action_t *restrict actions = domain->actions;
+    const uint32_t numActions = domain->numActions;
+    const uint32_t words = goap_domain_words(domain);
+    goap_plan_status_t status = GOAP_PLAN_NOT_FOUND;
+    uint32_t foundDepth = 0;
+    uint32_t bound = goap_heuristic_eval_dnf(&heuristic, start, goal);
+    uint32_t iteration = 0;
+    frames[0].state = start;
+    frames[0].g = 0;
+    frames[0].action = NO_ACTION;
+    if (goap_dnf_satisfied_n(&start, goal, words)) {
+        status = GOAP_PLAN_FOUND;
+    }
+
+    // set once any branch within the bound is cut off by the depth limit, after which a plan (if any) may be dearer
+    // than the cheapest one, and not finding one doesn't mean there isn't one
+    bool hitDepthLimit = false;
+    while (status == GOAP_PLAN_NOT_FOUND && bound != GOAP_HEURISTIC_INFINITY) {
+        iteration++;
+        uint32_t nextBound = GOAP_HEURISTIC_INFINITY;
+        uint32_t depth = 0;
+        frames[0].next = 0;
+        stats->nodesVisited++;
+
+        while (status == GOAP_PLAN_NOT_FOUND) {
+            ida_frame_t *frame = &frames[depth];
+            if (frame->next >= numActions) {
+                // exhausted this frame, backtrack
+                if (depth == 0) {
+                    break;
+                }
+                depth--;
+                continue;
+            }
+            uint32_t i = frame->next++;
+            const goap_compiled_action_t *action = &actions[i];
+            if (!goap_action_applicable(domain, action, &frame->state, words)) {
+                continue;
+            }
+            goap_cond_t childState = frame->state;
+            goap_cond_apply_n(&childState, &action->post, words);
+            if (on_path(frames, depth, &childState, words)) {
+                continue;
+            }
+            uint32_t g = frame->g + action->cost;
+#if !GOAP_STATIC
+            if (goap_cost_needed(&checks, i)) {
+                g = frame->g + goap_check_cost(&checks, i, &frame->state);
+            }
+#endif
+            uint32_t h = goap_heuristic_eval_dnf(&heuristic, childState, goal);
+            if (h == GOAP_HEURISTIC_INFINITY) {
+                continue;
+            }
+            uint64_t f = (uint64_t) g + h;
+            if (f > bound) {
+                if (f < nextBound) {
+                    nextBound = f;
+                }
+                continue;
+            }
+            if (depth + 1 > maxDepth) {
+                hitDepthLimit = true;
+                continue;
+            }
+#if !GOAP_STATIC
+            if (goap_check_needed(&checks, i) && !goap_check_compiled(&checks, i, &frame->state)) {
+                continue;
+            }
+#endif
+            if (entries > 0) {
+                ida_entry_t *entry = &table[entry_index(&childState, words, entries)];
+                if (entry->iteration == iteration && goap_cond_equal_n(&entry->state, &childState, words)
+                    && entry->g <= g) {
+                    // already searched from here this iteration, with at least as much budget left
+                    continue;
+                }
+                entry->state = childState;
+                entry->g = g;
+                entry->iteration = iteration;
+            }
+
+            depth++;
+            frames[depth].state = childState;
+            frames[depth].g = g;
+            frames[depth].action = i;
+            frames[depth].next = 0;
+            stats->nodesVisited++;
+            if (goap_dnf_satisfied_n(&childState, goal, words)) {
+                status = GOAP_PLAN_FOUND;
+                foundDepth = depth;
+            } else if (goap_deadline_passed(options, stats->nodesVisited)) {
+                status = GOAP_PLAN_BUDGET_EXCEEDED;
+                stats->timedOut = true;
+            }
+        }
+
+        if (status == GOAP_PLAN_NOT_FOUND && nextBound == GOAP_HEURISTIC_INFINITY) {
+            break;
+        }
+        bound = nextBound;
+    }
+    if (hitDepthLimit && status == GOAP_PLAN_FOUND) {
+        stats->suboptimalityBound = INFINITY;
+    } else if (hitDepthLimit && status == GOAP_PLAN_NOT_FOUND) {
+        // whether the limit came from maxDepth or the size of the workspace, the caller should know
+        status = GOAP_PLAN_BUDGET_EXCEEDED;
+    }
+
+    if (status == GOAP_PLAN_FOUND) {
+        *length = foundDepth;
+        stats->solutionsFound = 1;
+        stats->planCost = frames[foundDepth].g;
+        if (foundDepth > capacity && overflow != NULL) {
+            plan = *overflow = malloc(sizeof(uint32_t) * foundDepth);
+        }
+        if (foundDepth > capacity && overflow == NULL) {
+            status = GOAP_PLAN_TOO_LONG;
+        } else {
+            for (uint32_t i = 1; i <= foundDepth; i++) {
+                plan[i - 1] = frames[i].action;
+            }
+        }
+    }
+#if GOAP_DEBUG
+    printf("IDA* finished with status %d after %u iterations and %u nodes\n", status, iteration, stats->nodesVisited);
+#endif
+    stats->status = status;
+    stats->elapsedUs = goap_time_us() - startTime;
+#if !GOAP_STATIC
+    goap_check_free(&checks);
+#endif
+    free(allocation);
+    return status;
+}
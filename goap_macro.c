@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Macro learning. Every run of minLength to maxLength consecutive actions in a recorded plan is counted, keyed by the
+// actions' names each followed by MACRO_SEPARATOR, so that one run is inside another exactly when its key is inside
+// the other's (with a separator in front of both). The counts table is bounded by halving every count once it's full,
+// so runs that stop turning up are eventually forgotten, and the macros are picked from it every so often.
+
+/** follows each name in a run's key, it can't appear in an action's name without confusing the learner */
+#define MACRO_SEPARATOR '\x1f'
+
+DA_TYPEDEF(char, chararray_t)
+
+/** a run of actions that could become a macro */
+typedef struct {
+    const char *key;
+    uint32_t count;
+    uint32_t length;
+    /** how many steps it would have saved the searches so far */
+    uint64_t saving;
+} candidate_t;
+
+DA_TYPEDEF(candidate_t, candidatelist_t)
+
+void goap_macro_learner_init(goap_macro_learner_t *learner) {
+    memset(learner, 0, sizeof(*learner));
+    learner->maxMacros = 8;
+    learner->minLength = 2;
+    learner->maxLength = 4;
+    learner->minCount = 8;
+    learner->maxPatterns = 4096;
+    learner->updateInterval = 32;
+    pthread_mutex_init(&learner->lock, NULL);
+}
+
+void goap_macro_learner_free(goap_macro_learner_t *learner) {
+    map_deinit(&learner->counts);
+    goap_actionlist_free(&learner->macros);
+    pthread_mutex_destroy(&learner->lock);
+}
+
+/** halves every count, dropping the ones that reach zero, until the table has room again */
+static void decay_counts(goap_macro_learner_t *learner) {
+    while (learner->counts.base.nnodes >= learner->maxPatterns && learner->counts.base.nnodes > 0) {
+        // the map can't have entries removed while it's iterated over, so this builds a new one
+        map_int_t decayed = {0};
+        map_iter_t iter = map_iter();
+        const char *key = NULL;
+        while ((key = map_next(&learner->counts, &iter))) {
+            int count = *(int*) map_get_(&learner->counts.base, key) / 2;
+            if (count > 0) {
+                map_set(&decayed, key, count);
+            }
+        }
+        map_deinit(&learner->counts);
+        learner->counts = decayed;
+    }
+}
+
+/** returns true if the action exists and can be one of a macro's steps */
+static bool step_usable(const goap_action_t *action) {
+    return action != NULL && !action->internal && action->checkFunction == NULL && action->costFunction == NULL;
+}
+
+/** splits a run's key into the actions it names, returns false if any of them can't be part of a macro */
+static bool key_steps(const char *key, const goap_actionlist_t *allActions, goap_namelist_t *names) {
+    for (const char *name = key; *name != '\0';) {
+        const char *end = strchr(name, MACRO_SEPARATOR);
+        char *step = strndup(name, end - name);
+        da_add(*names, step);
+        if (!step_usable(goap_actionlist_find(allActions, step))) {
+            return false;
+        }
+        name = end + 1;
+    }
+    return true;
+}
+
+static void free_names(goap_namelist_t *names) {
+    for (size_t i = 0; i < da_count(*names); i++) {
+        free(names->p[i]);
+    }
+    da_free(*names);
+}
+
+/** returns true if the run with key inner is inside the one with key outer */
+static bool key_contains(const char *outer, const char *inner) {
+    for (const char *at = strstr(outer, inner); at != NULL; at = strstr(at + 1, inner)) {
+        // a match has to start at the beginning of a name, not part way through one
+        if (at == outer || at[-1] == MACRO_SEPARATOR) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int candidate_comparator(const void *a, const void *b) {
+    const candidate_t *x = a, *y = b;
+    if (x->saving != y->saving) {
+        return x->saving > y->saving ? -1 : 1;
+    }
+    // ties are broken by name, so the same counts always give the same macros
+    return strcmp(x->key, y->key);
+}
+
+/** goap_macro_learner_update(), with the lock held */
+static void update_locked(goap_macro_learner_t *learner, const goap_actionlist_t *allActions) {
+    candidatelist_t candidates = {0};
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(&learner->counts, &iter))) {
+        int count = *(int*) map_get_(&learner->counts.base, key);
+        if (count < 0 || (uint32_t) count < learner->minCount) {
+            continue;
+        }
+        candidate_t candidate = {key, count, 0, 0};
+        for (const char *c = key; *c != '\0'; c++) {
+            candidate.length += *c == MACRO_SEPARATOR;
+        }
+        candidate.saving = (uint64_t) count * (candidate.length - 1);
+        da_add(candidates, candidate);
+    }
+    if (da_count(candidates) > 0) {
+        qsort(candidates.p, da_count(candidates), sizeof(candidate_t), candidate_comparator);
+    }
+
+    goap_actionlist_t macros = {0};
+    candidatelist_t chosen = {0};
+    for (size_t i = 0; i < da_count(candidates) && da_count(macros) < learner->maxMacros; i++) {
+        const candidate_t *candidate = &candidates.p[i];
+        // a longer run saves more, so it's always considered first. If this one has never been seen outside it,
+        // it would only be taking up room.
+        bool covered = false;
+        for (size_t j = 0; j < da_count(chosen) && !covered; j++) {
+            covered = chosen.p[j].count >= candidate->count && key_contains(chosen.p[j].key, candidate->key);
+        }
+        goap_action_t macro = {0};
+        if (covered || !key_steps(candidate->key, allActions, &macro.subActions)) {
+            free_names(&macro.subActions);
+            continue;
+        }
+        chararray_t name = {0};
+        for (size_t j = 0; j < da_count(macro.subActions); j++) {
+            if (j > 0) {
+                da_add(name, '+');
+            }
+            da_addn(name, macro.subActions.p[j], strlen(macro.subActions.p[j]));
+        }
+        da_add(name, '\0');
+        macro.name = name.p;
+        macro.sequence = true;
+        if (!goap_action_summarise(&macro, allActions)) {
+            free(macro.name);
+            free_names(&macro.subActions);
+            continue;
+        }
+        da_add(macros, macro);
+        da_add(chosen, *candidate);
+    }
+#if GOAP_DEBUG
+    printf("Macro learner kept %zu macros out of %zu frequent runs:\n", da_count(macros), da_count(candidates));
+    for (size_t i = 0; i < da_count(macros); i++) {
+        printf("\t%s (seen %u times)\n", macros.p[i].name, chosen.p[i].count);
+    }
+#endif
+    da_free(chosen);
+    da_free(candidates);
+    goap_actionlist_free(&learner->macros);
+    learner->macros = macros;
+}
+
+void goap_macro_learner_update(goap_macro_learner_t *learner, const goap_actionlist_t *allActions) {
+    pthread_mutex_lock(&learner->lock);
+    update_locked(learner, allActions);
+    pthread_mutex_unlock(&learner->lock);
+}
+
+void goap_macro_learner_record(goap_macro_learner_t *learner, const goap_actionlist_t *plan,
+                               const goap_actionlist_t *allActions) {
+    chararray_t key = {0};
+    pthread_mutex_lock(&learner->lock);
+    for (size_t start = 0; start < da_count(*plan); start++) {
+        da_clear(key);
+        for (size_t length = 1; length <= learner->maxLength && start + length <= da_count(*plan); length++) {
+            const char *name = plan->p[start + length - 1].name;
+            da_addn(key, name, strlen(name));
+            da_add(key, MACRO_SEPARATOR);
+            if (length < learner->minLength) {
+                continue;
+            }
+            da_add(key, '\0');
+            int *count = map_get(&learner->counts, key.p);
+            if (count == NULL) {
+                decay_counts(learner);
+                map_set(&learner->counts, key.p, 1);
+            } else if (*count < INT32_MAX) {
+                map_set(&learner->counts, key.p, *count + 1);
+            }
+            da_pop(key);
+        }
+    }
+    learner->plansRecorded++;
+    if (learner->updateInterval > 0 && learner->plansRecorded % learner->updateInterval == 0) {
+        update_locked(learner, allActions);
+    }
+    pthread_mutex_unlock(&learner->lock);
+    da_free(key);
+}
+
+goap_actionlist_t goap_macro_learner_macros(goap_macro_learner_t *learner, const goap_actionlist_t *allActions) {
+    goap_actionlist_t copies = {0};
+    pthread_mutex_lock(&learner->lock);
+    for (size_t i = 0; i < da_count(learner->macros); i++) {
+        const goap_action_t *macro = &learner->macros.p[i];
+        bool usable = true;
+        for (size_t j = 0; j < da_count(macro->subActions) && usable; j++) {
+            usable = step_usable(goap_actionlist_find(allActions, macro->subActions.p[j]));
+        }
+        if (!usable) {
+            continue;
+        }
+        goap_action_t copy = {0};
+        copy.name = strdup(macro->name);
+        copy.sequence = true;
+        for (size_t j = 0; j < da_count(macro->subActions); j++) {
+            da_add(copy.subActions, strdup(macro->subActions.p[j]));
+        }
+        // the steps may have changed since the macro was learned, so its conditions and cost are worked out again
+        if (!goap_action_summarise(&copy, allActions)) {
+            free(copy.name);
+            free_names(&copy.subActions);
+            continue;
+        }
+        da_add(copies, copy);
+    }
+    pthread_mutex_unlock(&learner->lock);
+    return copies;
+}
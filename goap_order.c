@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+DA_TYPEDEF(uint32_t, indexlist_t)
+
+// Lifting a linear plan into a partial order. Two actions interfere if running them the other way around (or at the
+// same time) could change what one of them sees or what the world ends up as, and every pair that interferes keeps
+// the order the plan gave it. Any order of the actions that respects those pairs then behaves exactly like the plan.
+
+/** returns true if the action's check or cost depends on the whole world state */
+static bool reads_everything(const goap_action_t *action) {
+    return (action->checkFunction != NULL && action->checkVariables.base.nnodes == 0) ||
+           (action->costFunction != NULL && action->costVariables.base.nnodes == 0);
+}
+
+/** returns true if the action's preconditions, check or cost depend on the variable */
+static bool reads(const goap_action_t *action, const char *key) {
+    return reads_everything(action) || goap_worldstate_get(&action->preConditions, key) != NULL ||
+           (action->checkFunction != NULL && goap_worldstate_get(&action->checkVariables, key) != NULL) ||
+           (action->costFunction != NULL && goap_worldstate_get(&action->costVariables, key) != NULL);
+}
+
+/** returns true if the second action has to stay after the first one */
+static bool interferes(const goap_action_t *first, const goap_action_t *second) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(&first->postConditions, &iter))) {
+        // second may need what first sets, and if they both set it to different values, the last one wins
+        const bool *value = goap_worldstate_get(&second->postConditions, key);
+        if (reads(second, key) || (value != NULL && *value != *goap_worldstate_get(&first->postConditions, key))) {
+            return true;
+        }
+    }
+    iter = map_iter();
+    while ((key = map_next(&second->postConditions, &iter))) {
+        // second would change something first needs
+        if (reads(first, key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void goap_partial_order_compute(const goap_actionlist_t *plan, goap_partial_order_t *out) {
+    uint32_t count = da_count(*plan);
+    memset(out, 0, sizeof(*out));
+    out->count = count;
+    out->dependencyStart = calloc(count + 1, sizeof(uint32_t));
+    out->layer = calloc(count, sizeof(uint32_t));
+    out->byLayer = calloc(count, sizeof(uint32_t));
+
+    // before[j * count + i] is true if action i has to finish before j starts, directly or not. Going backwards from
+    // j, a later action always comes up before the earlier ones it depends on, so any dependency that another one
+    // already implies is skipped.
+    bool *before = calloc((size_t) count * count, sizeof(bool));
+    indexlist_t dependencies = {0};
+    for (uint32_t j = 0; j < count; j++) {
+        bool *ancestors = &before[(size_t) j * count];
+        for (uint32_t i = j; i-- > 0;) {
+            if (ancestors[i] || !interferes(&plan->p[i], &plan->p[j])) {
+                continue;
+            }
+            da_add(dependencies, i);
+            ancestors[i] = true;
+            for (uint32_t k = 0; k < i; k++) {
+                ancestors[k] |= before[(size_t) i * count + k];
+            }
+            if (out->layer[i] + 1 > out->layer[j]) {
+                out->layer[j] = out->layer[i] + 1;
+            }
+        }
+        out->dependencyStart[j + 1] = da_count(dependencies);
+        if (out->layer[j] + 1 > out->layerCount) {
+            out->layerCount = out->layer[j] + 1;
+        }
+    }
+    free(before);
+    out->dependencies = calloc(da_count(dependencies) + 1, sizeof(uint32_t));
+    if (da_count(dependencies) > 0) {
+        memcpy(out->dependencies, dependencies.p, da_count(dependencies) * sizeof(uint32_t));
+    }
+
+    // counting sort by layer, which keeps each layer in plan order
+    out->layerStart = calloc(out->layerCount + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        out->layerStart[out->layer[i] + 1]++;
+    }
+    for (uint32_t l = 0; l < out->layerCount; l++) {
+        out->layerStart[l + 1] += out->layerStart[l];
+    }
+    uint32_t *next = calloc(out->layerCount + 1, sizeof(uint32_t));
+    memcpy(next, out->layerStart, (out->layerCount + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        out->byLayer[next[out->layer[i]]++] = i;
+    }
+    free(next);
+
+#if GOAP_DEBUG
+    printf("Partial order: %u actions in %u layers, %zu dependencies\n", count, out->layerCount,
+           da_count(dependencies));
+#endif
+    da_free(dependencies);
+}
+
+void goap_partial_order_free(goap_partial_order_t *order) {
+    free(order->dependencyStart);
+    free(order->dependencies);
+    free(order->layer);
+    free(order->layerStart);
+    free(order->byLayer);
+    memset(order, 0, sizeof(*order));
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Persistent world states, stored as a hash array mapped trie keyed by the variables' symbols. Each branch uses 5 bits
+// of the key's hash to pick one of 32 slots, and only allocates the slots in use, found by counting the bits below the
+// slot in its bitmap. The hash is a bijection of the symbol, so no two variables ever share one, and leaves only need
+// to store the symbol rather than a copy of the name.
+//
+// Nodes are immutable once they're shared. An update copies the nodes on the path from the root to the key and points
+// the copies at the untouched subtrees, so a clone is just another reference to the root. A node with a single
+// reference can only be reached through the world state doing the update, so that's changed in place instead, which
+// means a run of updates to a fresh clone only copies each path once.
+
+enum {
+    PWORLD_LEAF,
+    PWORLD_BRANCH
+};
+
+#define BRANCH_BITS 5
+#define BRANCH_MASK ((1u << BRANCH_BITS) - 1)
+
+struct goap_pworld_node_t {
+    atomic_uint refs;
+    uint8_t kind;
+    /** the variable's value, for leaves */
+    bool value;
+    /** number of children, for branches */
+    uint16_t count;
+    /** the variable's symbol for leaves, or which of the 32 slots are in use for branches */
+    uint32_t bits;
+    /** children, in slot order */
+    goap_pworld_node_t *children[];
+};
+
+typedef goap_pworld_node_t node_t;
+
+/** multiplying by an odd number can be undone, so this spreads symbols out without ever mapping two to one hash */
+static inline uint32_t symbol_hash(goap_symbol_t symbol) {
+    return symbol * 0x9E3779B1u;
+}
+
+/** index of the slot's child in a branch's children */
+static inline uint32_t branch_index(const node_t *branch, uint32_t slot) {
+    return __builtin_popcount(branch->bits & ((1u << slot) - 1));
+}
+
+static inline uint32_t hash_slot(uint32_t hash, uint32_t shift) {
+    return (hash >> shift) & BRANCH_MASK;
+}
+
+static node_t *node_retain(node_t *node) {
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+    return node;
+}
+
+static void node_release(node_t *node) {
+    if (node == NULL || atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (node->kind == PWORLD_BRANCH) {
+        for (uint32_t i = 0; i < node->count; i++) {
+            node_release(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+static node_t *node_new(uint8_t kind, uint32_t bits, uint32_t count) {
+    node_t *node = malloc(sizeof(node_t) + sizeof(node_t*) * count);
+    atomic_init(&node->refs, 1);
+    node->kind = kind;
+    node->value = false;
+    node->count = count;
+    node->bits = bits;
+    return node;
+}
+
+static node_t *leaf_new(goap_symbol_t symbol, bool value) {
+    node_t *leaf = node_new(PWORLD_LEAF, symbol, 0);
+    leaf->value = value;
+    return leaf;
+}
+
+/**
+ * returns a version of the branch that can be changed, with room for extra more children. takes over the caller's
+ * reference: the branch itself if nothing else refers to it, otherwise a copy
+ */
+static node_t *node_own(node_t *node, uint32_t extra) {
+    if (atomic_load_explicit(&node->refs, memory_order_acquire) == 1) {
+        return extra > 0 ? realloc(node, sizeof(node_t) + sizeof(node_t*) * (node->count + extra)) : node;
+    }
+    node_t *copy = node_new(node->kind, node->bits, node->count + extra);
+    copy->count = node->count;
+    for (uint32_t i = 0; i < node->count; i++) {
+        copy->children[i] = node_retain(node->children[i]);
+    }
+    node_release(node);
+    return copy;
+}
+
+/** returns a branch holding a and b, two leaves for different variables, taking over both */
+static node_t *node_merge(node_t *a, node_t *b, uint32_t shift) {
+    uint32_t slotA = hash_slot(symbol_hash(a->bits), shift), slotB = hash_slot(symbol_hash(b->bits), shift);
+    if (slotA == slotB) {
+        node_t *branch = node_new(PWORLD_BRANCH, 1u << slotA, 1);
+        branch->children[0] = node_merge(a, b, shift + BRANCH_BITS);
+        return branch;
+    }
+    node_t *branch = node_new(PWORLD_BRANCH, (1u << slotA) | (1u << slotB), 2);
+    branch->children[slotA < slotB ? 0 : 1] = a;
+    branch->children[slotA < slotB ? 1 : 0] = b;
+    return branch;
+}
+
+/** sets symbol to value in the subtree, taking over the caller's reference to node and returning the new subtree */
+static node_t *node_insert(node_t *node, uint32_t shift, goap_symbol_t symbol, uint32_t hash, bool value, bool *added) {
+    if (node == NULL) {
+        *added = true;
+        return leaf_new(symbol, value);
+    }
+    if (node->kind == PWORLD_LEAF) {
+        if (node->bits == symbol) {
+            if (atomic_load_explicit(&node->refs, memory_order_acquire) == 1) {
+                node->value = value;
+                return node;
+            }
+            node_release(node);
+            return leaf_new(symbol, value);
+        }
+        *added = true;
+        return node_merge(node, leaf_new(symbol, value), shift);
+    }
+
+    uint32_t slot = hash_slot(hash, shift);
+    uint32_t index = branch_index(node, slot);
+    if (node->bits & (1u << slot)) {
+        node = node_own(node, 0);
+        node->children[index] = node_insert(node->children[index], shift + BRANCH_BITS, symbol, hash, value, added);
+        return node;
+    }
+    *added = true;
+    node = node_own(node, 1);
+    memmove(&node->children[index + 1], &node->children[index], sizeof(node_t*) * (node->count - index));
+    node->children[index] = leaf_new(symbol, value);
+    node->bits |= 1u << slot;
+    node->count++;
+    return node;
+}
+
+/**
+ * removes the variable with the given hash from the subtree, which must contain it. takes over the caller's reference
+ * to node and returns the new subtree, or NULL if it's now empty
+ */
+static node_t *node_remove(node_t *node, uint32_t shift, uint32_t hash) {
+    if (node->kind == PWORLD_LEAF) {
+        node_release(node);
+        return NULL;
+    }
+    uint32_t slot = hash_slot(hash, shift);
+    uint32_t index = branch_index(node, slot);
+    node = node_own(node, 0);
+    node_t *child = node_remove(node->children[index], shift + BRANCH_BITS, hash);
+    if (child != NULL) {
+        node->children[index] = child;
+    } else {
+        memmove(&node->children[index], &node->children[index + 1], sizeof(node_t*) * (node->count - index - 1));
+        node->count--;
+        node->bits &= ~(1u << slot);
+    }
+    if (node->count == 0) {
+        node_release(node);
+        return NULL;
+    }
+    if (node->count == 1 && node->children[0]->kind == PWORLD_LEAF) {
+        // a lone leaf doesn't need a branch above it, it can sit wherever its hash leads first
+        node_t *only = node_retain(node->children[0]);
+        node_release(node);
+        return only;
+    }
+    return node;
+}
+
+const bool *goap_pworld_get_symbol(const goap_pworld_t *world, goap_symbol_t symbol) {
+    uint32_t hash = symbol_hash(symbol);
+    const node_t *node = world->root;
+    for (uint32_t shift = 0; node != NULL; shift += BRANCH_BITS) {
+        if (node->kind == PWORLD_LEAF) {
+            return node->bits == symbol ? &node->value : NULL;
+        }
+        uint32_t slot = hash_slot(hash, shift);
+        if (!(node->bits & (1u << slot))) {
+            return NULL;
+        }
+        node = node->children[branch_index(node, slot)];
+    }
+    return NULL;
+}
+
+const bool *goap_pworld_get(const goap_pworld_t *world, const char *key) {
+    // a name that was never interned can't be in any world state
+    goap_symbol_t symbol = goap_symbol_find(key);
+    return symbol != GOAP_SYMBOL_NONE ? goap_pworld_get_symbol(world, symbol) : NULL;
+}
+
+void goap_pworld_set_symbol(goap_pworld_t *world, goap_symbol_t symbol, bool value) {
+    bool added = false;
+    world->root = node_insert(world->root, 0, symbol, symbol_hash(symbol), value, &added);
+    world->count += added;
+}
+
+void goap_pworld_set(goap_pworld_t *world, const char *key, bool value) {
+    goap_pworld_set_symbol(world, goap_symbol_intern(key), value);
+}
+
+void goap_pworld_remove(goap_pworld_t *world, const char *key) {
+    goap_symbol_t symbol = goap_symbol_find(key);
+    if (symbol == GOAP_SYMBOL_NONE || goap_pworld_get_symbol(world, symbol) == NULL) {
+        return;
+    }
+    world->root = node_remove(world->root, 0, symbol_hash(symbol));
+    world->count--;
+}
+
+goap_pworld_t goap_pworld_clone(const goap_pworld_t *world) {
+    goap_pworld_t clone = *world;
+    if (clone.root != NULL) {
+        node_retain(clone.root);
+    }
+    return clone;
+}
+
+void goap_pworld_free(goap_pworld_t *world) {
+    node_release(world->root);
+    world->root = NULL;
+    world->count = 0;
+}
+
+goap_pworld_iter_t goap_pworld_iter(const goap_pworld_t *world) {
+    goap_pworld_iter_t iter = {0};
+    if (world->root != NULL) {
+        iter.nodes[0] = world->root;
+        iter.depth = 1;
+    }
+    return iter;
+}
+
+const char *goap_pworld_next(const goap_pworld_t *world, goap_pworld_iter_t *iter) {
+    while (iter->depth > 0) {
+        uint32_t top = iter->depth - 1;
+        const node_t *node = iter->nodes[top];
+        if (node->kind == PWORLD_LEAF) {
+            iter->depth--;
+            iter->symbol = node->bits;
+            iter->value = &node->value;
+            return goap_symbol_name(node->bits);
+        }
+        if (iter->next[top] >= node->count) {
+            iter->depth--;
+            continue;
+        }
+        iter->nodes[iter->depth] = node->children[iter->next[top]++];
+        iter->next[iter->depth] = 0;
+        iter->depth++;
+    }
+    return NULL;
+}
+
+goap_pworld_t goap_pworld_from_worldstate(const goap_worldstate_t *world) {
+    goap_pworld_t out = {0};
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(world, &iter))) {
+        goap_pworld_set(&out, key, *goap_worldstate_get(world, key));
+    }
+    return out;
+}
+
+bool goap_pworld_compare(const goap_pworld_t *world, const goap_worldstate_t *goal) {
+    map_iter_t iter = map_iter();
+    const char *key = NULL;
+    while ((key = map_next(goal, &iter))) {
+        // same closed world assumption as goap_worldstate_compare()
+        const bool *value = goap_pworld_get(world, key);
+        if (value == NULL || *value != *goap_worldstate_get(goal, key)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void goap_pworld_dump(const goap_pworld_t *world) {
+    goap_pworld_iter_t iter = goap_pworld_iter(world);
+    const char *key = NULL;
+    while ((key = goap_pworld_next(world, &iter))) {
+        printf("\t%s: %s\n", key, *iter.value ? "true" : "false");
+    }
+    if (world->count == 0) {
+        printf("\t(empty world state)\n");
+    }
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_scheduler.h"
+#include <stdio.h>
+
+#define TABLE_INITIAL_SIZE 64
+#define WAITER_ITER(array) goap_sched_waiter_t *it = da_begin(array), *end = da_end(array); it != end; ++it
+
+/** returns true if request a should be served before request b */
+static bool request_before(goap_sched_request_t *a, goap_sched_request_t *b) {
+    if (a->key == b->key) {
+        // FIFO between requests of equal standing
+        return a->id < b->id;
+    }
+    return a->key > b->key;
+}
+
+static void heap_swap(goap_sched_queue_t *queue, size_t a, size_t b) {
+    goap_sched_request_t *tmp = queue->p[a];
+    queue->p[a] = queue->p[b];
+    queue->p[b] = tmp;
+    queue->p[a]->heapIndex = a;
+    queue->p[b]->heapIndex = b;
+}
+
+static void heap_sift_up(goap_sched_queue_t *queue, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!request_before(queue->p[i], queue->p[parent])) {
+            break;
+        }
+        heap_swap(queue, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_push(goap_sched_queue_t *queue, goap_sched_request_t *request) {
+    request->heapIndex = da_count(*queue);
+    da_add(*queue, request);
+    heap_sift_up(queue, request->heapIndex);
+}
+
+static goap_sched_request_t *heap_pop(goap_sched_queue_t *queue) {
+    goap_sched_request_t *top = queue->p[0];
+    goap_sched_request_t *last = da_pop(*queue);
+    top->heapIndex = SIZE_MAX;
+    size_t count = da_count(*queue);
+    if (count == 0) {
+        return top;
+    }
+    queue->p[0] = last;
+    last->heapIndex = 0;
+    size_t i = 0;
+    while (true) {
+        size_t left = i * 2 + 1, right = left + 1, best = i;
+        if (left < count && request_before(queue->p[left], queue->p[best])) {
+            best = left;
+        }
+        if (right < count && request_before(queue->p[right], queue->p[best])) {
+            best = right;
+        }
+        if (best == i) {
+            break;
+        }
+        heap_swap(queue, i, best);
+        i = best;
+    }
+    return top;
+}
+
+/** returns true if both world states contain exactly the same keys and values */
+static bool worldstate_equal(const goap_worldstate_t *a, const goap_worldstate_t *b) {
+    return a->base.nnodes == b->base.nnodes && goap_worldstate_compare_v2(a, b);
+}
+
+static void table_insert(goap_scheduler_t *scheduler, goap_sched_request_t *request) {
+    if (scheduler->tableCount >= scheduler->tableSize) {
+        // grow and rehash, we keep the load factor at most 1
+        size_t newSize = scheduler->tableSize > 0 ? scheduler->tableSize * 2 : TABLE_INITIAL_SIZE;
+        goap_sched_request_t **newTable = calloc(newSize, sizeof(*newTable));
+        for (size_t i = 0; i < scheduler->tableSize; i++) {
+            goap_sched_request_t *node = scheduler->table[i];
+            while (node) {
+                goap_sched_request_t *next = node->next;
+                size_t bucket = node->hash & (newSize - 1);
+                node->next = newTable[bucket];
+                newTable[bucket] = node;
+                node = next;
+            }
+        }
+        free(scheduler->table);
+        scheduler->table = newTable;
+        scheduler->tableSize = newSize;
+    }
+    size_t bucket = request->hash & (scheduler->tableSize - 1);
+    request->next = scheduler->table[bucket];
+    scheduler->table[bucket] = request;
+    scheduler->tableCount++;
+}
+
+static void table_remove(goap_scheduler_t *scheduler, goap_sched_request_t *request) {
+    goap_sched_request_t **ref = &scheduler->table[request->hash & (scheduler->tableSize - 1)];
+    while (*ref != request) {
+        ref = &(*ref)->next;
+    }
+    *ref = request->next;
+    scheduler->tableCount--;
+}
+
+/** finds a queued or in-flight request identical to the given one, or returns NULL */
+static goap_sched_request_t *table_find(goap_scheduler_t *scheduler, uint64_t hash, const goap_worldstate_t *current,
+                                        const goap_worldstate_t *goal, goap_library_t *library, uint64_t generation) {
+    if (scheduler->tableSize == 0) {
+        return NULL;
+    }
+    goap_sched_request_t *node = scheduler->table[hash & (scheduler->tableSize - 1)];
+    for (; node != NULL; node = node->next) {
+        // the hash is only a hint, so make sure it's actually the same request before sharing a plan with it
+        if (node->hash == hash && node->library == library && node->generation == generation
+            && worldstate_equal(&node->current, current) && worldstate_equal(&node->goal, goal)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void request_free(goap_sched_request_t *request) {
+    map_deinit(&request->current);
+    map_deinit(&request->goal);
+    da_free(request->waiters);
+    free(request);
+}
+
+static void update_queue_stats(goap_scheduler_t *scheduler) {
+    scheduler->stats.queueDepth = da_count(scheduler->queue);
+    if (scheduler->stats.queueDepth > scheduler->stats.peakQueueDepth) {
+        scheduler->stats.peakQueueDepth = scheduler->stats.queueDepth;
+    }
+}
+
+void goap_scheduler_init(goap_scheduler_t *scheduler, goap_scheduler_config_t config) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->config = config;
+    pthread_mutex_init(&scheduler->lock, NULL);
+}
+
+uint32_t goap_scheduler_submit(goap_scheduler_t *scheduler, goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                               goap_library_t *library, uint32_t priority, float distance,
+                               goap_plan_callback_t callback, void *userdata) {
+    // hash outside the lock, it only touches the caller's data
+    uint64_t hash = goap_worldstate_hash_v2(&currentWorld) * 31 + goap_worldstate_hash_v2(&goal);
+    hash = hash * 31 + (uintptr_t) library;
+    // reading the generation before taking the lock is fine, a reload between here and table_find() only means this
+    // request won't be coalesced with ones submitted after the reload
+    uint64_t generation = goap_library_generation(library);
+    hash = hash * 31 + generation;
+    uint64_t now = goap_time_us();
+
+    pthread_mutex_lock(&scheduler->lock);
+    goap_sched_waiter_t waiter = {0};
+    waiter.id = scheduler->nextId++;
+    waiter.submitTime = now;
+    waiter.submitTick = scheduler->tick;
+    waiter.callback = callback;
+    waiter.userdata = userdata;
+    // a request's aged priority is priority + agingPerTick * (tick - submitTick). the tick term is the same for
+    // every request in the queue, so we can order the heap by the part that doesn't change while it waits
+    int64_t key = (int64_t) priority - (int64_t) scheduler->config.agingPerTick * (int64_t) scheduler->tick;
+    scheduler->stats.submitted++;
+
+    goap_sched_request_t *existing = table_find(scheduler, hash, &currentWorld, &goal, library, generation);
+    if (existing != NULL) {
+        // singleflight: piggyback on the identical request rather than searching again
+        da_add(existing->waiters, waiter);
+        scheduler->stats.coalesced++;
+        if (existing->heapIndex != SIZE_MAX && key > existing->key) {
+            existing->key = key;
+            existing->priority = priority;
+            existing->submitTick = waiter.submitTick;
+            heap_sift_up(&scheduler->queue, existing->heapIndex);
+        }
+        if (distance < existing->distance) {
+            existing->distance = distance;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        return waiter.id;
+    }
+
+    goap_sched_request_t *request = calloc(1, sizeof(*request));
+    request->key = key;
+    request->id = waiter.id;
+    request->priority = priority;
+    request->distance = distance;
+    request->submitTick = waiter.submitTick;
+    request->hash = hash;
+    request->current = goap_worldstate_clone_v2(&currentWorld);
+    request->goal = goap_worldstate_clone_v2(&goal);
+    request->library = library;
+    request->generation = generation;
+    da_add(request->waiters, waiter);
+    table_insert(scheduler, request);
+    heap_push(&scheduler->queue, request);
+    update_queue_stats(scheduler);
+    pthread_mutex_unlock(&scheduler->lock);
+    return waiter.id;
+}
+
+size_t goap_scheduler_tick(goap_scheduler_t *scheduler) {
+    goap_scheduler_config_t *config = &scheduler->config;
+    uint64_t tickStart = goap_time_us();
+    size_t served = 0;
+    size_t planned = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+    uint64_t tick = scheduler->tick++;
+    // requests submitted since this tick started (including by our own callbacks, which usually replan) belong to the
+    // next one. they're put aside and queued again at the end, otherwise a callback that always resubmits would keep
+    // an unlimited tick going forever
+    goap_sched_queue_t later = {0};
+    while (da_count(scheduler->queue) > 0) {
+        if (config->budgetUs > 0 && goap_time_us() - tickStart >= config->budgetUs) {
+            break;
+        }
+        // the request stays in the table while we plan it, so identical submissions can still join it
+        goap_sched_request_t *request = heap_pop(&scheduler->queue);
+        if (request->submitTick > tick) {
+            da_add(later, request);
+            continue;
+        }
+        uint64_t waited = tick - request->submitTick;
+        uint64_t agedPriority = request->priority + (uint64_t) config->agingPerTick * waited;
+
+        // level of detail: agents that don't matter much get a cheaper, less thorough search
+        bool downgrade = agedPriority < config->lodPriority
+                         || (config->lodDistance > 0 && request->distance > config->lodDistance);
+        goap_planner_options_t options = downgrade ? config->lodOptions : config->options;
+        if (config->budgetUs > 0) {
+            options.deadlineUs = tickStart + config->budgetUs;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+
+        goap_plan_stats_t planStats = {0};
+        goap_library_version_t *version = goap_library_acquire(request->library);
+        goap_actionlist_t plan = goap_library_plan_v2(version, &request->current, &request->goal, &options,
+                                                      &planStats);
+        planned++;
+        if (config->budgetUs > 0 && planStats.timedOut && planStats.status == GOAP_PLAN_BUDGET_EXCEEDED
+            && planned > 1) {
+            // it only had what was left of the tick, so try again on a later one rather than failing it. one that
+            // doesn't fit in a whole tick, or ran out of memory or depth, really is over budget, and its waiters are
+            // told so
+            goap_library_release(version);
+            da_free(plan);
+            pthread_mutex_lock(&scheduler->lock);
+            da_add(later, request);
+            break;
+        }
+
+        // once it's out of the table nobody else can attach to it, so the waiter list is final
+        pthread_mutex_lock(&scheduler->lock);
+        table_remove(scheduler, request);
+        pthread_mutex_unlock(&scheduler->lock);
+
+        uint64_t now = goap_time_us();
+        uint64_t maxLatency = 0, totalLatency = 0, maxWait = 0;
+        size_t count = da_count(request->waiters);
+        for (WAITER_ITER(request->waiters)) {
+            uint64_t latency = now - it->submitTime;
+            totalLatency += latency;
+            maxLatency = latency > maxLatency ? latency : maxLatency;
+            // waiters that joined while the plan was being made haven't waited at all
+            uint64_t wait = it->submitTick > tick ? 0 : tick - it->submitTick;
+            maxWait = wait > maxWait ? wait : maxWait;
+            // every waiter owns its plan, the last one gets the original
+            goap_actionlist_t copy = {0};
+            if (it + 1 == end) {
+                copy = plan;
+            } else if (da_count(plan) > 0) {
+                da_addn(copy, plan.p, da_count(plan));
+            }
+            it->callback(copy, planStats, it->userdata);
+        }
+        goap_library_release(version);
+        request_free(request);
+        served += count;
+
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->stats.served += count;
+        scheduler->stats.downgraded += downgrade ? count : 0;
+        scheduler->stats.totalLatencyUs += totalLatency;
+        if (maxLatency > scheduler->stats.maxLatencyUs) {
+            scheduler->stats.maxLatencyUs = maxLatency;
+        }
+        if (maxWait > scheduler->stats.maxWaitTicks) {
+            scheduler->stats.maxWaitTicks = maxWait;
+        }
+    }
+
+    for (size_t i = 0; i < da_count(later); i++) {
+        heap_push(&scheduler->queue, later.p[i]);
+    }
+    da_free(later);
+    scheduler->stats.queueDepth = da_count(scheduler->queue);
+    scheduler->stats.lastTickServed = served;
+    scheduler->stats.lastTickUs = goap_time_us() - tickStart;
+#if GOAP_DEBUG
+    printf("Scheduler tick served %zu requests in %lu us, %zu still queued\n", served,
+           (unsigned long) scheduler->stats.lastTickUs, scheduler->stats.queueDepth);
+#endif
+    pthread_mutex_unlock(&scheduler->lock);
+    return served;
+}
+
+goap_scheduler_stats_t goap_scheduler_get_stats(goap_scheduler_t *scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    goap_scheduler_stats_t stats = scheduler->stats;
+    pthread_mutex_unlock(&scheduler->lock);
+    return stats;
+}
+
+void goap_scheduler_free(goap_scheduler_t *scheduler) {
+    for (goap_sched_request_t **it = da_begin(scheduler->queue), **end = da_end(scheduler->queue); it != end; ++it) {
+        request_free(*it);
+    }
+    da_free(scheduler->queue);
+    free(scheduler->table);
+    pthread_mutex_destroy(&scheduler->lock);
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <pthread.h>
+#include "goap.h"
+
+// The scheduler lets many agents ask for plans in the same frame without blowing the frame time. Requests are
+// queued and served by goap_scheduler_tick() in priority order until the tick's time budget is used up, so
+// any requests that didn't fit are simply served on a later tick.
+//
+// Requests are planned with goap_library_plan(), so they share the library's relevance cache.
+// Identical requests (same current world, goal and library generation) are coalesced: only one search is run, and every
+// request that was waiting on it receives a copy of the plan. A request submitted after the library is reloaded never
+// joins a search started before it. All functions are thread safe, so agents may submit
+// from any thread, and several worker threads may call goap_scheduler_tick() at once.
+
+/**
+ * Called when a queued request has been planned. The callback owns the plan and must free it with da_free().
+ * If no plan could be found, the list is empty. The plan's actions belong to stats.libraryVersion, which is released
+ * after the callback returns, so call goap_library_retain() on it to keep using the plan after that.
+ */
+typedef void (*goap_plan_callback_t)(goap_actionlist_t plan, goap_plan_stats_t stats, void *userdata);
+
+typedef struct {
+    /**
+     * time each call to goap_scheduler_tick() may spend planning, in microseconds. 0 means no limit. Each search is
+     * given what's left of it as a deadline. A request that runs out of time is tried again on a later tick, unless
+     * it already had the whole tick to itself, in which case it's served with GOAP_PLAN_BUDGET_EXCEEDED. Callbacks
+     * run on the ticking thread, so the time they take still counts against the budget.
+     */
+    uint64_t budgetUs;
+    /** priority points a request gains for every tick it waits, so low priority agents are never starved */
+    uint32_t agingPerTick;
+    /** requests whose aged priority is below this are planned with lodOptions */
+    uint32_t lodPriority;
+    /** requests from agents further away than this are planned with lodOptions. 0 disables this check. */
+    float lodDistance;
+    /** search settings used for normal requests */
+    goap_planner_options_t options;
+    /** cheaper search settings used for low priority or far away requests, e.g. weighted A* or greedy search */
+    goap_planner_options_t lodOptions;
+} goap_scheduler_config_t;
+
+typedef struct {
+    /** number of requests currently waiting to be planned */
+    size_t queueDepth;
+    /** largest queueDepth seen so far */
+    size_t peakQueueDepth;
+    uint64_t submitted;
+    uint64_t served;
+    /** number of served requests that were planned with lodOptions */
+    uint64_t downgraded;
+    /** number of requests that shared another request's search instead of running their own */
+    uint64_t coalesced;
+    /** sum and maximum of the time between submission and completion of each served request, in microseconds */
+    uint64_t totalLatencyUs;
+    uint64_t maxLatencyUs;
+    /** largest number of ticks a served request spent waiting in the queue */
+    uint64_t maxWaitTicks;
+    /** number of requests served and time spent by the last call to goap_scheduler_tick() */
+    size_t lastTickServed;
+    uint64_t lastTickUs;
+} goap_scheduler_stats_t;
+
+/** someone waiting on the result of a request, internal to the scheduler */
+typedef struct {
+    uint32_t id;
+    uint64_t submitTime;
+    uint64_t submitTick;
+    goap_plan_callback_t callback;
+    void *userdata;
+} goap_sched_waiter_t;
+
+DA_TYPEDEF(goap_sched_waiter_t, goap_sched_waiterlist_t)
+
+/** a planning request, internal to the scheduler */
+typedef struct goap_sched_request_t {
+    /** static ordering key, see goap_scheduler_submit() */
+    int64_t key;
+    /** lowest ID of all the waiters, used to break ties */
+    uint32_t id;
+    uint32_t priority;
+    float distance;
+    uint64_t submitTick;
+    /** hash of the current world, goal, library and generation, used to find identical requests */
+    uint64_t hash;
+    /** position in the queue heap, or SIZE_MAX once the request is being planned */
+    size_t heapIndex;
+    /** next request in the same bucket of the in-flight table */
+    struct goap_sched_request_t *next;
+    goap_worldstate_t current;
+    goap_worldstate_t goal;
+    goap_library_t *library;
+    /** generation of the library when the request was submitted */
+    uint64_t generation;
+    /** everyone who will receive the plan, in order of submission */
+    goap_sched_waiterlist_t waiters;
+} goap_sched_request_t;
+
+DA_TYPEDEF(goap_sched_request_t*, goap_sched_queue_t)
+
+typedef struct {
+    goap_scheduler_config_t config;
+    pthread_mutex_t lock;
+    /** binary max-heap of requests that haven't been started yet, ordered by key */
+    goap_sched_queue_t queue;
+    /** hash table of every request that is queued or being planned, chained through next */
+    goap_sched_request_t **table;
+    size_t tableSize;
+    size_t tableCount;
+    uint64_t tick;
+    uint32_t nextId;
+    goap_scheduler_stats_t stats;
+} goap_scheduler_t;
+
+/** Initialises an empty scheduler with the given settings */
+void goap_scheduler_init(goap_scheduler_t *scheduler, goap_scheduler_config_t config);
+/**
+ * Queues a planning request. The world states are copied, so the caller may free them straight away, but the library
+ * is not, so it must stay alive until the callback is invoked. The request is planned with whichever version of the
+ * library is current when it's served.
+ * If an identical request is already queued or being planned, this request is attached to it instead, and the
+ * shared request is served at the higher of the two priorities.
+ * @param priority higher priority requests are served first
+ * @param distance distance from the agent to whatever is observing it, used to pick cheaper search settings
+ * @return an ID for the request, which is unique within this scheduler
+ */
+uint32_t goap_scheduler_submit(goap_scheduler_t *scheduler, goap_worldstate_t currentWorld, goap_worldstate_t goal,
+                               goap_library_t *library, uint32_t priority, float distance,
+                               goap_plan_callback_t callback, void *userdata);
+/**
+ * Serves queued requests in order of their aged priority until the time budget for this tick is used up,
+ * invoking each request's callback as it completes. Requests submitted after the tick started, including by the
+ * callbacks, are left for the next tick.
+ * @return the number of requests that were served
+ */
+size_t goap_scheduler_tick(goap_scheduler_t *scheduler);
+/** Returns a snapshot of the scheduler's queue and latency statistics */
+goap_scheduler_stats_t goap_scheduler_get_stats(goap_scheduler_t *scheduler);
+/** Frees the scheduler. Requests still in the queue are dropped without their callbacks being invoked. */
+void goap_scheduler_free(goap_scheduler_t *scheduler);
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap_domain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Best first search over a compiled domain. Every strategy is the same loop, they only differ in how the open list is
+// ordered: by g (uniform cost), g + h (A*), g + w * h (weighted A*) or h alone (greedy).
+// With GOAP_DELTA_STATES, nodes don't hold their state: it's rebuilt from the closest ancestor that kept a snapshot by
+// replaying the actions since, and the closed table compares stored hashes before rebuilding anything.
+
+#define NO_NODE UINT32_MAX
+#define TABLE_INITIAL_SIZE 256
+
+typedef struct {
+#if GOAP_DELTA_STATES
+    /** hash_state() of the node's state */
+    uint64_t hash;
+    /** index of the node's state in the snapshots, or NO_NODE if it has to be rebuilt with node_state() */
+    uint32_t snapshot;
+#else
+    goap_cond_t state;
+#endif
+    /** cost so far */
+    uint32_t g;
+    uint32_t parent;
+    /** action that took us here from the parent */
+    uint32_t action;
+    uint32_t depth;
+} search_node_t;
+
+typedef struct {
+    /** the open list's priority */
+    double f;
+    /** ties are broken towards the node closer to the goal, then the older one */
+    uint32_t h;
+    uint32_t node;
+} open_entry_t;
+
+DA_TYPEDEF(search_node_t, search_nodelist_t)
+DA_TYPEDEF(open_entry_t, open_list_t)
+DA_TYPEDEF(goap_cond_t, search_statelist_t)
+
+#if GOAP_STATIC
+_Static_assert((GOAP_MAX_NODES & (GOAP_MAX_NODES - 1)) == 0, "GOAP_MAX_NODES must be a power of two");
+// every node is pushed onto the open list at most once, and the table is kept at most half full
+static search_node_t staticNodes[GOAP_MAX_NODES];
+static open_entry_t staticOpen[GOAP_MAX_NODES];
+static uint32_t staticTable[GOAP_MAX_NODES * 2];
+#endif
+
+typedef struct {
+    const goap_domain_t *domain;
+    /** goap_domain_words() of the domain, only this much of each state is hashed and compared */
+    uint32_t words;
+    search_nodelist_t nodes;
+#if GOAP_DELTA_STATES
+    /** full states of the nodes every GOAP_SNAPSHOT_INTERVAL levels deep */
+    search_statelist_t snapshots;
+#endif
+    /** binary min-heap */
+    open_list_t open;
+    /** open addressing hash table from state to the cheapest node reaching it */
+    uint32_t *table;
+    size_t tableSize;
+    size_t tableCount;
+} search_t;
+
+static inline uint64_t hash_state(const goap_cond_t *state, uint32_t words) {
+    uint64_t hash = goap_cond_hash_n(state, words);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+static bool open_before(open_entry_t *a, open_entry_t *b) {
+    if (a->f != b->f) {
+        return a->f < b->f;
+    }
+    if (a->h != b->h) {
+        return a->h < b->h;
+    }
+    return a->node < b->node;
+}
+
+static void open_push(open_list_t *open, open_entry_t entry) {
+    da_add(*open, entry);
+    size_t i = da_count(*open) - 1;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!open_before(&open->p[i], &open->p[parent])) {
+            break;
+        }
+        open_entry_t tmp = open->p[i];
+        open->p[i] = open->p[parent];
+        open->p[parent] = tmp;
+        i = parent;
+    }
+}
+
+static open_entry_t open_pop(open_list_t *open) {
+    open_entry_t top = open->p[0];
+    open_entry_t last = da_pop(*open);
+    size_t count = da_count(*open);
+    if (count == 0) {
+        return top;
+    }
+    open->p[0] = last;
+    size_t i = 0;
+    while (true) {
+        size_t left = i * 2 + 1, right = left + 1, best = i;
+        if (left < count && open_before(&open->p[left], &open->p[best])) {
+            best = left;
+        }
+        if (right < count && open_before(&open->p[right], &open->p[best])) {
+            best = right;
+        }
+        if (best == i) {
+            break;
+        }
+        open_entry_t tmp = open->p[i];
+        open->p[i] = open->p[best];
+        open->p[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+#if GOAP_DELTA_STATES
+/** rebuilds the state of a node by replaying the actions taken since its closest snapshot */
+static void node_state(const search_t *search, uint32_t index, goap_cond_t *out) {
+    uint32_t replay[GOAP_SNAPSHOT_INTERVAL];
+    uint32_t count = 0;
+    while (search->nodes.p[index].snapshot == NO_NODE) {
+        replay[count++] = search->nodes.p[index].action;
+        index = search->nodes.p[index].parent;
+    }
+    *out = search->snapshots.p[search->nodes.p[index].snapshot];
+    while (count > 0) {
+        goap_cond_apply_n(out, &search->domain->actions[replay[--count]].post, search->words);
+    }
+}
+
+static inline uint64_t node_hash(const search_t *search, uint32_t index) {
+    return search->nodes.p[index].hash;
+}
+
+/** stores the node's state, which only keeps a copy of it every GOAP_SNAPSHOT_INTERVAL levels */
+static void node_set_state(search_t *search, search_node_t *node, const goap_cond_t *state, uint64_t hash) {
+    node->hash = hash;
+    node->snapshot = NO_NODE;
+    if (node->depth % GOAP_SNAPSHOT_INTERVAL == 0) {
+        node->snapshot = da_count(search->snapshots);
+        da_add(search->snapshots, *state);
+    }
+}
+
+static bool node_has_state(const search_t *search, uint32_t index, const goap_cond_t *state, uint64_t hash) {
+    if (search->nodes.p[index].hash != hash) {
+        return false;
+    }
+    goap_cond_t nodeState;
+    node_state(search, index, &nodeState);
+    return goap_cond_equal_n(&nodeState, state, search->words);
+}
+#else
+static inline void node_state(const search_t *search, uint32_t index, goap_cond_t *out) {
+    *out = search->nodes.p[index].state;
+}
+
+static inline uint64_t node_hash(const search_t *search, uint32_t index) {
+    return hash_state(&search->nodes.p[index].state, search->words);
+}
+
+static inline void node_set_state(search_t *search, search_node_t *node, const goap_cond_t *state, uint64_t hash) {
+    node->state = *state;
+}
+
+static inline bool node_has_state(const search_t *search, uint32_t index, const goap_cond_t *state, uint64_t hash) {
+    return goap_cond_equal_n(&search->nodes.p[index].state, state, search->words);
+}
+#endif
+
+/**
+ * returns the slot in the table for the given state, which is either empty or holds a node with that state. hash is
+ * hash_state() of the state
+ */
+static uint32_t *table_slot(search_t *search, const goap_cond_t *state, uint64_t hash) {
+    size_t mask = search->tableSize - 1;
+    size_t i = hash & mask;
+    while (search->table[i] != NO_NODE && !node_has_state(search, search->table[i], state, hash)) {
+        i = (i + 1) & mask;
+    }
+    return &search->table[i];
+}
+
+#if GOAP_STATIC
+static void search_init(search_t *search) {
+    da_init_external(search->nodes, staticNodes, GOAP_MAX_NODES);
+    da_init_external(search->open, staticOpen, GOAP_MAX_NODES);
+    search->table = staticTable;
+    search->tableSize = GOAP_MAX_NODES * 2;
+    memset(search->table, 0xFF, sizeof(staticTable));
+}
+
+/** returns true if another node can be added without the search running out of space */
+static inline bool search_has_room(search_t *search) {
+    return da_count(search->nodes) < GOAP_MAX_NODES;
+}
+#else
+static void table_grow(search_t *search) {
+    uint32_t *old = search->table;
+    size_t oldSize = search->tableSize;
+    search->tableSize = oldSize > 0 ? oldSize * 2 : TABLE_INITIAL_SIZE;
+    search->table = malloc(sizeof(uint32_t) * search->tableSize);
+    memset(search->table, 0xFF, sizeof(uint32_t) * search->tableSize);
+    // the states in the table are all different, so each one just goes in the first free slot
+    size_t mask = search->tableSize - 1;
+    for (size_t i = 0; i < oldSize; i++) {
+        if (old[i] != NO_NODE) {
+            size_t j = node_hash(search, old[i]) & mask;
+            while (search->table[j] != NO_NODE) {
+                j = (j + 1) & mask;
+            }
+            search->table[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+static void search_init(search_t *search) {
+    table_grow(search);
+}
+
+static inline bool search_has_room(search_t *search) {
+    return true;
+}
+#endif
+
+/** writes the actions leading to the given node into the plan buffer, or overflow if it's too short, see plan_dnf_ex */
+static goap_plan_status_t reconstruct(search_t *search, uint32_t node, uint32_t *plan, size_t capacity,
+                                      size_t *length, uint32_t **overflow) {
+    *length = search->nodes.p[node].depth;
+    if (*length > capacity) {
+        if (overflow == NULL) {
+            return GOAP_PLAN_TOO_LONG;
+        }
+        plan = *overflow = malloc(sizeof(uint32_t) * *length);
+    }
+    for (size_t i = *length; i > 0; i--) {
+        plan[i - 1] = search->nodes.p[node].action;
+        node = search->nodes.p[node].parent;
+    }
+    return GOAP_PLAN_FOUND;
+}
+
+/** returns the suboptimality bound the given settings guarantee */
+float goap_search_quality_bound(goap_search_t strategy, goap_heuristic_t heuristic, float weight) {
+    bool admissible = heuristic == GOAP_HEURISTIC_NONE || heuristic == GOAP_HEURISTIC_MAX;
+    switch (strategy) {
+        case GOAP_SEARCH_UNIFORM_COST:
+            return 1.0f;
+        case GOAP_SEARCH_ASTAR:
+        case GOAP_SEARCH_IDASTAR:
+            return admissible ? 1.0f : INFINITY;
+        case GOAP_SEARCH_WEIGHTED_ASTAR:
+            return admissible ? weight : INFINITY;
+        default:
+            return INFINITY;
+    }
+}
+
+goap_plan_status_t goap_domain_plan(const goap_domain_t *domain, goap_cond_t start, goap_cond_t goal,
+                                   const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                   uint32_t *plan, size_t capacity, size_t *length) {
+    goap_dnf_t dnf = {&goal, 1};
+    return goap_domain_plan_dnf(domain, start, dnf, options, stats, plan, capacity, length);
+}
+
+goap_plan_status_t goap_domain_plan_dnf(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                       const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                       uint32_t *plan, size_t capacity, size_t *length) {
+    return goap_domain_plan_dnf_ex(domain, start, goal, options, stats, plan, capacity, length, NULL);
+}
+
+goap_plan_status_t goap_domain_plan_dnf_ex(const goap_domain_t *domain, goap_cond_t start, goap_dnf_t goal,
+                                          const goap_planner_options_t *options, goap_plan_stats_t *stats,
+                                          uint32_t *plan, size_t capacity, size_t *length, uint32_t **overflow) {
+    if (overflow != NULL) {
+        *overflow = NULL;
+    }
+    goap_planner_options_t defaults = {0};
+    defaults.search = GOAP_SEARCH_ASTAR;
+    if (options == NULL) {
+        options = &defaults;
+    }
+    if (options->search == GOAP_SEARCH_IDASTAR) {
+        return goap_idastar_plan(domain, start, goal, options, stats, plan, capacity, length, overflow);
+    }
+    goap_plan_stats_t dummyStats;
+    if (stats == NULL) {
+        stats = &dummyStats;
+    }
+    memset(stats, 0, sizeof(*stats));
+    uint64_t startTime = goap_time_us();
+    *length = 0;
+
+    goap_search_t strategy = options->search;
+    goap_heuristic_t heuristicType = strategy == GOAP_SEARCH_UNIFORM_COST ? GOAP_HEURISTIC_NONE : options->heuristic;
+    double weight = strategy == GOAP_SEARCH_WEIGHTED_ASTAR && options->weight > 1.0f ? options->weight : 1.0;
+    bool greedy = strategy == GOAP_SEARCH_GREEDY;
+    stats->suboptimalityBound = goap_search_quality_bound(strategy, heuristicType, (float) weight);
+
+    goap_heuristic_ctx_t heuristic;
+    goap_heuristic_init(&heuristic, domain, heuristicType);
+    search_t search = {0};
+    search.domain = domain;
+    search.words = goap_domain_words(domain);
+    search_init(&search);
+#if !GOAP_STATIC
+    goap_check_cache_t checks;
+    goap_check_init(&checks, domain, options->actions, options->startWorld);
+#endif
+
+    search_node_t root = {0};
+    root.parent = NO_NODE;
+    root.action = NO_NODE;
+    uint64_t rootHash = hash_state(&start, search.words);
+    node_set_state(&search, &root, &start, rootHash);
+    da_add(search.nodes, root);
+    *table_slot(&search, &start, rootHash) = 0;
+    search.tableCount = 1;
+    uint32_t rootH = goap_heuristic_eval_dnf(&heuristic, start, goal);
+    if (rootH != GOAP_HEURISTIC_INFINITY) {
+        open_entry_t entry = {greedy ? rootH : weight * rootH, rootH, 0};
+        open_push(&search.open, entry);
+    }
+
+    uint32_t found = NO_NODE;
+    bool exhausted = false;
+    if (goap_dnf_satisfied_n(&start, goal, search.words)) {
+        found = 0;
+    }
+    // the loop writes to the node arrays, which as far as the compiler knows could alias the domain. promising that
+    // they don't lets it keep the action table in registers instead of reloading it after every store
+    const goap_compiled_action_t *restrict actions = domain->actions;
+    const uint32_t numActions = domain->numActions;
+    const uint32_t words = search.words;
+    while (found == NO_NODE && !exhausted && da_count(search.open) > 0) {
+        open_entry_t entry = open_pop(&search.open);
+        search_node_t node = search.nodes.p[entry.node];
+        goap_cond_t state;
+        node_state(&search, entry.node, &state);
+        if (*table_slot(&search, &state, node_hash(&search, entry.node)) != entry.node) {
+            // stale entry, a cheaper path to this state was found after it was pushed
+            continue;
+        }
+        if (goap_dnf_satisfied_n(&state, goal, words)) {
+            found = entry.node;
+            break;
+        }
+        stats->nodesVisited++;
+        if (goap_deadline_passed(options, stats->nodesVisited)) {
+            exhausted = stats->timedOut = true;
+            break;
+        }
+        if (options->maxDepth > 0 && node.depth >= options->maxDepth) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < numActions; i++) {
+            const goap_compiled_action_t *action = &actions[i];
+            if (!goap_action_applicable(domain, action, &state, words)) {
+                continue;
+            }
+            goap_cond_t childState = state;
+            goap_cond_apply_n(&childState, &action->post, words);
+            uint64_t childHash = hash_state(&childState, words);
+            uint32_t cost = action->cost;
+#if !GOAP_STATIC
+            if (goap_cost_needed(&checks, i)) {
+                cost = goap_check_cost(&checks, i, &state);
+            }
+#endif
+            search_node_t child;
+            child.g = node.g + cost;
+            child.parent = entry.node;
+            child.action = i;
+            child.depth = node.depth + 1;
+
+            uint32_t *slot = table_slot(&search, &childState, childHash);
+            if (*slot != NO_NODE && (greedy || search.nodes.p[*slot].g <= child.g)) {
+                // greedy search never reopens states, the others only do so if we found a cheaper path
+                continue;
+            }
+            uint32_t h = goap_heuristic_eval_dnf(&heuristic, childState, goal);
+            if (h == GOAP_HEURISTIC_INFINITY) {
+                continue;
+            }
+#if !GOAP_STATIC
+            // procedural checks are the expensive part, so they go last, once nothing else rules the child out
+            if (goap_check_needed(&checks, i) && !goap_check_compiled(&checks, i, &state)) {
+                continue;
+            }
+#endif
+            if (!search_has_room(&search)) {
+                exhausted = true;
+                break;
+            }
+            uint32_t index = da_count(search.nodes);
+            node_set_state(&search, &child, &childState, childHash);
+            da_add(search.nodes, child);
+            if (*slot == NO_NODE) {
+                search.tableCount++;
+            }
+            *slot = index;
+            if (greedy && goap_dnf_satisfied_n(&childState, goal, words)) {
+                // there's no optimality to preserve, so we may as well stop as soon as we see the goal
+                found = index;
+                break;
+            }
+            open_entry_t childEntry = {greedy ? h : child.g + weight * h, h, index};
+            open_push(&search.open, childEntry);
+#if !GOAP_STATIC
+            if (search.tableCount * 2 >= search.tableSize) {
+                table_grow(&search);
+            }
+#endif
+        }
+    }
+
+    goap_plan_status_t status = GOAP_PLAN_NOT_FOUND;
+    if (found != NO_NODE) {
+        status = reconstruct(&search, found, plan, capacity, length, overflow);
+        stats->solutionsFound = 1;
+        stats->planCost = search.nodes.p[found].g;
+    } else if (exhausted) {
+        status = GOAP_PLAN_BUDGET_EXCEEDED;
+    }
+#if GOAP_DEBUG
+    printf("Best first search %s after expanding %u nodes\n", found != NO_NODE ? "found a plan" : "failed",
+           stats->nodesVisited);
+#endif
+    stats->status = status;
+    stats->elapsedUs = goap_time_us() - startTime;
+    goap_heuristic_free(&heuristic);
+#if !GOAP_STATIC
+    goap_check_free(&checks);
+#endif
+    da_free(search.nodes);
+    da_free(search.open);
+#if GOAP_DELTA_STATES
+    da_free(search.snapshots);
+#endif
+#if !GOAP_STATIC
+    free(search.table);
+#endif
+    return status;
+}
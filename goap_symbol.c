@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "goap.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The symbol table every persistent world state and search shares. Names are interned once for the life of the
+// program and never freed, so the pointers goap_symbol_name() returns stay valid, and two symbols can be compared
+// without looking at their names at all. Interning takes the write lock, but only the first time a name is seen, so
+// planning calls after the first just take the read lock.
+
+typedef map_t(goap_symbol_t) map_symbol_t;
+DA_TYPEDEF(char*, namelist_t)
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+/** symbol of each interned name */
+static map_symbol_t symbols;
+/** name of each symbol, indexed by the symbol */
+static namelist_t names;
+
+goap_symbol_t goap_symbol_find(const char *name) {
+    pthread_rwlock_rdlock(&lock);
+    const goap_symbol_t *symbol = map_get_(&symbols.base, name);
+    goap_symbol_t out = symbol != NULL ? *symbol : GOAP_SYMBOL_NONE;
+    pthread_rwlock_unlock(&lock);
+    return out;
+}
+
+goap_symbol_t goap_symbol_intern(const char *name) {
+    goap_symbol_t symbol = goap_symbol_find(name);
+    if (symbol != GOAP_SYMBOL_NONE) {
+        return symbol;
+    }
+    pthread_rwlock_wrlock(&lock);
+    // someone else may have interned it between the two locks
+    const goap_symbol_t *existing = map_get_(&symbols.base, name);
+    if (existing != NULL) {
+        symbol = *existing;
+    } else {
+        symbol = da_count(names);
+        da_add(names, strdup(name));
+        map_set(&symbols, name, symbol);
+    }
+    pthread_rwlock_unlock(&lock);
+    return symbol;
+}
+
+const char *goap_symbol_name(goap_symbol_t symbol) {
+    pthread_rwlock_rdlock(&lock);
+    const char *name = symbol < da_count(names) ? names.p[symbol] : NULL;
+    pthread_rwlock_unlock(&lock);
+    return name;
+}
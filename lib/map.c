@@ -1,4 +1,4 @@
-/** 
+/**
  * Copyright (c) 2014 rxi
  *
  * This library is free software; you can redistribute it and/or modify it
@@ -9,185 +9,280 @@
 #include <string.h>
 #include "map.h"
 
-struct map_node_t {
+/* keys shorter than this are stored in the slot, longer ones go in the key arena */
+#define MAP_INLINE_KEY 16
+/* the table grows once it's this many eighths full */
+#define MAP_MAX_LOAD 6
+#define MAP_MIN_BUCKETS 8
+
+typedef struct {
+  /* hash of the key, never 0, which marks an empty slot */
   unsigned hash;
-  void *value;
-  map_node_t *next;
-  /* char key[]; */
+  /* length of the key, not counting the terminator */
+  unsigned ksize;
+  /* the key if ksize < MAP_INLINE_KEY, otherwise its offset in the key arena */
+  char key[MAP_INLINE_KEY];
   /* char value[]; */
-};
+} map_slot_t;
+
+#define map_slot(m, i)\
+  ( (map_slot_t*) ((m)->slots + (size_t) (i) * (m)->slotsize) )
 
 
-static unsigned map_hash(const char *str) {
+static unsigned map_hash(const char *str, unsigned *ksize) {
+  const char *c = str;
   unsigned hash = 5381;
-  while (*str) {
-    hash = ((hash << 5) + hash) ^ *str++;
+  while (*c) {
+    hash = ((hash << 5) + hash) ^ *c++;
   }
-  return hash;
+  *ksize = c - str;
+  return hash ? hash : 1;
 }
 
 
-static map_node_t *map_newnode(const char *key, void *value, int vsize) {
-  map_node_t *node;
-  int ksize = strlen(key) + 1;
-  int voffset = ksize + ((sizeof(void*) - ksize) % sizeof(void*));
-  node = malloc(sizeof(*node) + voffset + vsize);
-  if (!node) return NULL;
-  memcpy(node + 1, key, ksize);
-  node->hash = map_hash(key);
-  node->value = ((char*) (node + 1)) + voffset;
-  memcpy(node->value, value, vsize);
-  return node;
+static char *map_arena(const map_base_t *m) {
+  return m->slots + (size_t) m->nbuckets * m->slotsize;
 }
 
 
-static int map_bucketidx(map_base_t *m, unsigned hash) {
-  /* If the implementation is changed to allow a non-power-of-2 bucket count,
-   * the line below should be changed to use mod instead of AND */
-  return hash & (m->nbuckets - 1);
+static const char *map_slotkey(const map_base_t *m, const map_slot_t *slot) {
+  unsigned offset;
+  if (slot->ksize < MAP_INLINE_KEY) {
+    return slot->key;
+  }
+  memcpy(&offset, slot->key, sizeof(offset));
+  return map_arena(m) + offset;
 }
 
 
-static void map_addnode(map_base_t *m, map_node_t *node) {
-  int n = map_bucketidx(m, node->hash);
-  node->next = m->buckets[n];
-  m->buckets[n] = node;
+/* how far the slot at idx is from where its hash wants it to be */
+static unsigned map_dist(const map_base_t *m, const map_slot_t *slot, unsigned idx) {
+  return (idx - slot->hash) & (m->nbuckets - 1);
 }
 
 
-static int map_resize(map_base_t *m, int nbuckets) {
-  map_node_t *nodes, *node, *next;
-  map_node_t **buckets;
-  int i; 
-  /* Chain all nodes together */
-  nodes = NULL;
-  i = m->nbuckets;
-  while (i--) {
-    node = (m->buckets)[i];
-    while (node) {
-      next = node->next;
-      node->next = nodes;
-      nodes = node;
-      node = next;
-    }
+static map_slot_t *map_find(const map_base_t *m, const char *key, unsigned hash, unsigned ksize) {
+  unsigned idx, dist;
+  map_slot_t *slot;
+  if (m->nnodes == 0) {
+    return NULL;
   }
-  /* Reset buckets */
-  buckets = realloc(m->buckets, sizeof(*m->buckets) * nbuckets);
-  if (buckets != NULL) {
-    m->buckets = buckets;
-    m->nbuckets = nbuckets;
-  }
-  if (m->buckets) {
-    memset(m->buckets, 0, sizeof(*m->buckets) * m->nbuckets);
-    /* Re-add nodes to buckets */
-    node = nodes;
-    while (node) {
-      next = node->next;
-      map_addnode(m, node);
-      node = next;
+  idx = hash & (m->nbuckets - 1);
+  for (dist = 0;; dist++) {
+    slot = map_slot(m, idx);
+    /* Robin Hood ordering means the key would have been placed before any slot that is closer to home than us */
+    if (slot->hash == 0 || map_dist(m, slot, idx) < dist) {
+      return NULL;
+    }
+    if (slot->hash == hash && slot->ksize == ksize && !memcmp(map_slotkey(m, slot), key, ksize)) {
+      return slot;
     }
+    idx = (idx + 1) & (m->nbuckets - 1);
   }
-  /* Return error code if realloc() failed */
-  return (buckets == NULL) ? -1 : 0;
 }
 
 
-static map_node_t **map_getref(map_base_t *m, const char *key) {
-  unsigned hash = map_hash(key);
-  map_node_t **next;
-  if (m->nbuckets > 0) {
-    next = &m->buckets[map_bucketidx(m, hash)];
-    while (*next) {
-      if ((*next)->hash == hash && !strcmp((char*) (*next + 1), key)) {
-        return next;
-      }
-      next = &(*next)->next;
+/* places entry in the table, displacing richer slots as it goes. entry and tmp are slotsize bytes of scratch */
+static void map_insert(map_base_t *m, map_slot_t *entry, map_slot_t *tmp) {
+  unsigned mask = m->nbuckets - 1;
+  unsigned idx = entry->hash & mask;
+  unsigned dist = 0, slotdist;
+  map_slot_t *slot;
+  for (;;) {
+    slot = map_slot(m, idx);
+    if (slot->hash == 0) {
+      memcpy(slot, entry, m->slotsize);
+      return;
+    }
+    slotdist = map_dist(m, slot, idx);
+    if (slotdist < dist) {
+      memcpy(tmp, slot, m->slotsize);
+      memcpy(slot, entry, m->slotsize);
+      memcpy(entry, tmp, m->slotsize);
+      dist = slotdist;
     }
+    idx = (idx + 1) & mask;
+    dist++;
   }
-  return NULL;
 }
 
 
-void map_deinit_(map_base_t *m) {
-  map_node_t *next, *node;
-  int i;
-  i = m->nbuckets;
-  while (i--) {
-    node = m->buckets[i];
-    while (node) {
-      next = node->next;
-      free(node);
-      node = next;
+/* rebuilds the table with nbuckets slots, which also compacts the key arena */
+static int map_resize(map_base_t *m, unsigned nbuckets, map_slot_t *entry, map_slot_t *tmp) {
+  map_base_t old = *m;
+  unsigned i, offset, keysize = 0;
+  map_slot_t *slot;
+  for (i = 0; i < old.nbuckets; i++) {
+    slot = map_slot(&old, i);
+    if (slot->hash != 0 && slot->ksize >= MAP_INLINE_KEY) {
+      keysize += slot->ksize + 1;
+    }
+  }
+  m->slots = malloc((size_t) nbuckets * m->slotsize + keysize);
+  if (m->slots == NULL) {
+    *m = old;
+    return -1;
+  }
+  memset(m->slots, 0, (size_t) nbuckets * m->slotsize);
+  m->nbuckets = nbuckets;
+  m->keysused = 0;
+  m->keyscap = keysize;
+  for (i = 0; i < old.nbuckets; i++) {
+    slot = map_slot(&old, i);
+    if (slot->hash == 0) {
+      continue;
     }
+    memcpy(entry, slot, m->slotsize);
+    if (slot->ksize >= MAP_INLINE_KEY) {
+      offset = m->keysused;
+      memcpy(map_arena(m) + offset, map_slotkey(&old, slot), slot->ksize + 1);
+      memcpy(entry->key, &offset, sizeof(offset));
+      m->keysused += slot->ksize + 1;
+    }
+    map_insert(m, entry, tmp);
   }
-  free(m->buckets);
+  free(old.slots);
+  return 0;
 }
 
 
-void *map_get_(map_base_t *m, const char *key) {
-  map_node_t **next = map_getref(m, key);
-  return next ? (*next)->value : NULL;
+/* makes room for a key of ksize bytes in the arena */
+static int map_reserve_key(map_base_t *m, unsigned ksize) {
+  unsigned cap = m->keyscap;
+  char *slots;
+  if (m->keysused + ksize + 1 <= cap) {
+    return 0;
+  }
+  while (m->keysused + ksize + 1 > cap) {
+    cap = cap ? cap << 1 : 64;
+  }
+  slots = realloc(m->slots, (size_t) m->nbuckets * m->slotsize + cap);
+  if (slots == NULL) {
+    return -1;
+  }
+  m->slots = slots;
+  m->keyscap = cap;
+  return 0;
+}
+
+
+void map_deinit_(map_base_t *m) {
+  free(m->slots);
+  memset(m, 0, sizeof(*m));
+}
+
+
+void *map_get_(const map_base_t *m, const char *key) {
+  unsigned ksize;
+  unsigned hash = map_hash(key, &ksize);
+  map_slot_t *slot = map_find(m, key, hash, ksize);
+  return slot ? (char*) (slot + 1) : NULL;
 }
 
 
 int map_set_(map_base_t *m, const char *key, void *value, int vsize) {
-  int n, err;
-  map_node_t **next, *node;
-  /* Find & replace existing node */
-  next = map_getref(m, key);
-  if (next) {
-    memcpy((*next)->value, value, vsize);
+  char stack[2 * 64];
+  char *scratch = stack;
+  unsigned ksize, offset;
+  unsigned hash = map_hash(key, &ksize);
+  map_slot_t *slot, *entry, *tmp;
+  int err = -1;
+  /* Find & replace existing slot */
+  slot = map_find(m, key, hash, ksize);
+  if (slot) {
+    memcpy(slot + 1, value, vsize);
     return 0;
   }
-  /* Add new node */
-  node = map_newnode(key, value, vsize);
-  if (node == NULL) goto fail;
-  if (m->nnodes >= m->nbuckets) {
-    n = (m->nbuckets > 0) ? (m->nbuckets << 1) : 1;
-    err = map_resize(m, n);
-    if (err) goto fail;
+  if (m->slotsize == 0) {
+    m->slotsize = sizeof(map_slot_t) + ((vsize + 7) & ~7);
   }
-  map_addnode(m, node);
+  if (2 * m->slotsize > sizeof(stack)) {
+    scratch = malloc(2 * m->slotsize);
+    if (scratch == NULL) return -1;
+  }
+  entry = (map_slot_t*) scratch;
+  tmp = (map_slot_t*) (scratch + m->slotsize);
+  /* Grow before inserting, so the key arena offset we hand out stays valid */
+  if ((m->nnodes + 1) * 8 > m->nbuckets * MAP_MAX_LOAD) {
+    if (map_resize(m, m->nbuckets ? m->nbuckets << 1 : MAP_MIN_BUCKETS, entry, tmp)) goto done;
+  }
+  memset(entry, 0, m->slotsize);
+  entry->hash = hash;
+  entry->ksize = ksize;
+  if (ksize < MAP_INLINE_KEY) {
+    memcpy(entry->key, key, ksize + 1);
+  } else {
+    if (map_reserve_key(m, ksize)) goto done;
+    offset = m->keysused;
+    memcpy(map_arena(m) + offset, key, ksize + 1);
+    memcpy(entry->key, &offset, sizeof(offset));
+    m->keysused += ksize + 1;
+  }
+  memcpy(entry + 1, value, vsize);
+  map_insert(m, entry, tmp);
   m->nnodes++;
-  return 0;
-  fail:
-  if (node) free(node);
-  return -1;
+  err = 0;
+  done:
+  if (scratch != stack) free(scratch);
+  return err;
 }
 
 
 void map_remove_(map_base_t *m, const char *key) {
-  map_node_t *node;
-  map_node_t **next = map_getref(m, key);
-  if (next) {
-    node = *next;
-    *next = (*next)->next;
-    free(node);
-    m->nnodes--;
+  unsigned ksize, idx, next;
+  unsigned hash = map_hash(key, &ksize);
+  map_slot_t *slot = map_find(m, key, hash, ksize);
+  map_slot_t *nextslot;
+  if (!slot) {
+    return;
   }
+  /* shift the following slots back rather than leaving a tombstone. a long key's bytes stay in the arena until the
+   * next resize */
+  idx = ((char*) slot - m->slots) / m->slotsize;
+  for (;;) {
+    next = (idx + 1) & (m->nbuckets - 1);
+    nextslot = map_slot(m, next);
+    if (nextslot->hash == 0 || map_dist(m, nextslot, next) == 0) {
+      map_slot(m, idx)->hash = 0;
+      break;
+    }
+    memcpy(map_slot(m, idx), nextslot, m->slotsize);
+    idx = next;
+  }
+  m->nnodes--;
 }
 
 
 map_iter_t map_iter_(void) {
   map_iter_t iter;
   iter.bucketidx = -1;
-  iter.node = NULL;
   return iter;
 }
 
 
-const char *map_next_(map_base_t *m, map_iter_t *iter) {
-  if (iter->node) {
-    iter->node = iter->node->next;
-    if (iter->node == NULL) goto nextBucket;
-  } else {
-    nextBucket:
-    do {
-      if (++iter->bucketidx >= m->nbuckets) {
-        return NULL;
-      }
-      iter->node = m->buckets[iter->bucketidx];
-    } while (iter->node == NULL);
-  }
-  return (char*) (iter->node + 1);
+const char *map_next_(const map_base_t *m, map_iter_t *iter) {
+  map_slot_t *slot;
+  while (++iter->bucketidx < m->nbuckets) {
+    slot = map_slot(m, iter->bucketidx);
+    if (slot->hash != 0) {
+      return map_slotkey(m, slot);
+    }
+  }
+  return NULL;
+}
+
+
+int map_clone_(map_base_t *dst, const map_base_t *src) {
+  size_t size = (size_t) src->nbuckets * src->slotsize + src->keyscap;
+  *dst = *src;
+  if (src->slots == NULL) {
+    return 0;
+  }
+  dst->slots = malloc(size);
+  if (dst->slots == NULL) {
+    memset(dst, 0, sizeof(*dst));
+    return -1;
+  }
+  memcpy(dst->slots, src->slots, size);
+  return 0;
 }
@@ -12,17 +12,21 @@
 
 #define MAP_VERSION "0.1.0"
 
-struct map_node_t;
-typedef struct map_node_t map_node_t;
-
+/* The map is an open addressing hash table using Robin Hood hashing. Each slot stores the key's hash, the key itself
+ * if it's short (see map.c) and the value, so a lookup usually touches one cache line. Keys too long to fit in the
+ * slot live in an arena at the end of the same allocation, so a whole map is one block of memory and can be copied
+ * with map_clone(). Pointers returned by map_get() and map_next() are only valid until the map is next modified. */
 typedef struct {
-  map_node_t **buckets;
+  /* nbuckets slots of slotsize bytes each, followed by the key arena */
+  char *slots;
   unsigned nbuckets, nnodes;
+  unsigned slotsize;
+  /* bytes of the key arena in use and allocated */
+  unsigned keysused, keyscap;
 } map_base_t;
 
 typedef struct {
   unsigned bucketidx;
-  map_node_t *node;
 } map_iter_t;
 
 
@@ -59,12 +63,17 @@ typedef struct {
   map_next_(&(m)->base, iter)
 
 
+#define map_clone(dst, src)\
+  map_clone_(&(dst)->base, &(src)->base)
+
+
 void map_deinit_(map_base_t *m);
-void *map_get_(map_base_t *m, const char *key);
+void *map_get_(const map_base_t *m, const char *key);
 int map_set_(map_base_t *m, const char *key, void *value, int vsize);
 void map_remove_(map_base_t *m, const char *key);
 map_iter_t map_iter_(void);
-const char *map_next_(map_base_t *m, map_iter_t *iter);
+const char *map_next_(const map_base_t *m, map_iter_t *iter);
+int map_clone_(map_base_t *dst, const map_base_t *src);
 
 
 typedef map_t(void*) map_void_t;
@@ -104,6 +104,19 @@ int main() {
     puts("\nPlan:");
     goap_actionlist_dump(plan);
 
+    // actions that don't depend on each other can be run at the same time
+    goap_partial_order_t order;
+    goap_partial_order_compute(&plan, &order);
+    puts("\nParallel layers:");
+    for (uint32_t l = 0; l < order.layerCount; l++) {
+        printf("\t%u:", l);
+        for (uint32_t i = order.layerStart[l]; i < order.layerStart[l + 1]; i++) {
+            printf(" %s", plan.p[order.byLayer[i]].name);
+        }
+        puts("");
+    }
+    goap_partial_order_free(&order);
+
     // cleanup
     fflush(stdout);
     da_free(plan);
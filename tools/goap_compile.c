@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <errno.h>
+
+#define DG_DYNARR_IMPLEMENTATION
+#include "DG_dynarr.h"
+#undef DG_DYNARR_IMPLEMENTATION
+#include "goap.h"
+#include "goap_domain.h"
+
+// Compiles a JSON action list, or a domain in the text language (see docs/Language.txt), into the binary domain format,
+// which goap_load_binary() can load without parsing.
+// Usage: goap_compile <actions.json|domain.txt> <output.goapb>
+// The output is loaded back and compared against the compiled domain before the tool reports success.
+
+/** util function to return a null terminated string from a file on disk */
+static char *utils_load_file(const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open file \"%s\": %s\n", path, strerror(errno));
+        *size = 0;
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(*size + 1);
+    fread(buf, 1, *size, f);
+    fclose(f);
+    buf[*size] = '\0';
+    return buf;
+}
+
+/** returns true if both domains have the same actions, goal, variables, numbers and names */
+static bool domain_equal(const goap_domain_t *a, const goap_domain_t *b) {
+    return a->numActions == b->numActions && a->numVars == b->numVars && a->stringsSize == b->stringsSize
+           && a->numAlternatives == b->numAlternatives && a->numGoalAlternatives == b->numGoalAlternatives
+           && a->numNumbers == b->numNumbers
+           && memcmp(a->actions, b->actions, sizeof(goap_compiled_action_t) * a->numActions) == 0
+           && memcmp(a->alternatives, b->alternatives, sizeof(goap_cond_t) * a->numAlternatives) == 0
+           && memcmp(a->numbers, b->numbers, sizeof(goap_compiled_number_t) * a->numNumbers) == 0
+           && memcmp(a->varNames, b->varNames, sizeof(uint32_t) * a->numVars) == 0
+           && memcmp(a->sortedVars, b->sortedVars, sizeof(uint32_t) * a->numVars) == 0
+           && memcmp(a->strings, b->strings, a->stringsSize) == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <actions.json|domain.txt> <output.goapb>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long sourceSize = 0;
+    char *source = utils_load_file(argv[1], &sourceSize);
+    if (source == NULL) {
+        return EXIT_FAILURE;
+    }
+    static goap_domain_t domain, loaded;
+    goap_parse_error_t error;
+    size_t pathLength = strlen(argv[1]);
+    bool json = pathLength >= 5 && strcmp(argv[1] + pathLength - 5, ".json") == 0;
+    bool parsed = json ? goap_domain_load_json(&domain, source, sourceSize, &error)
+                       : goap_domain_load_text(&domain, source, sourceSize, NULL, &error);
+    free(source);
+    if (!parsed) {
+        fprintf(stderr, "%s:%zu: %s\n", argv[1], error.offset, error.message);
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_FAILURE;
+    if (!goap_domain_save_binary(&domain, argv[2])) {
+        fprintf(stderr, "Failed to write %s\n", argv[2]);
+    } else if (!goap_load_binary(&loaded, argv[2]) || !domain_equal(&domain, &loaded)) {
+        fprintf(stderr, "%s doesn't load back to the same domain\n", argv[2]);
+    } else {
+        printf("Compiled %u actions and %u variables from %s into %s\n", domain.numActions, domain.numVars,
+               argv[1], argv[2]);
+        result = EXIT_SUCCESS;
+    }
+
+    goap_domain_free(&loaded);
+    goap_domain_free(&domain);
+    return result;
+}
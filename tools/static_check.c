@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020 Matt Young.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define DG_DYNARR_IMPLEMENTATION
+#include "DG_dynarr.h"
+#undef DG_DYNARR_IMPLEMENTATION
+#include "goap.h"
+#include "goap_domain.h"
+
+// This program checks that the GOAP_STATIC build profile really never touches the heap while planning.
+// It replaces malloc and friends with versions that abort while "armed", loads and compiles a domain normally (which
+// is allowed to allocate), then arms them and plans with every search strategy. This relies on glibc's __libc_*
+// functions, so it only builds on Linux.
+
+#if !GOAP_STATIC
+#error "static_check must be built with GOAP_STATIC=1"
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/** if true, any heap call aborts the program */
+static volatile bool armed = false;
+
+static void heap_violation(const char *function) {
+    // can't use stdio here, since it might allocate
+    const char *msg = "static_check: heap function called while planning: ";
+    write(STDERR_FILENO, msg, strlen(msg));
+    write(STDERR_FILENO, function, strlen(function));
+    write(STDERR_FILENO, "\n", 1);
+    abort();
+}
+
+void *malloc(size_t size) {
+    if (armed) heap_violation("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    if (armed) heap_violation("calloc");
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (armed) heap_violation("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (armed && ptr != NULL) heap_violation("free");
+    __libc_free(ptr);
+}
+
+/** util function to return a null terminated string from a file on disk */
+static char *utils_load_file(const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open file \"%s\": %s\n", path, strerror(errno));
+        *size = 0;
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(*size + 1);
+    fread(buf, 1, *size, f);
+    fclose(f);
+    buf[*size] = '\0';
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "../test_data/actions_work.json";
+    long jsonSize = 0;
+    char *jsonStr = utils_load_file(path, &jsonSize);
+    if (jsonStr == NULL) {
+        return EXIT_FAILURE;
+    }
+    goap_actionlist_t actions = goap_parse_json(jsonStr, jsonSize);
+    static goap_domain_t domain;
+    if (da_count(actions) == 0 || !goap_domain_compile(&domain, actions)) {
+        fprintf(stderr, "Failed to load domain from %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    goap_worldstate_t currentState = {0};
+    goap_worldstate_t goalState = {0};
+    map_set(&currentState, "Awake", false);
+    map_set(&goalState, "Employed", true);
+    map_set(&goalState, "Happy", true);
+    map_set(&goalState, "Awake", false);
+    map_set(&goalState, "Clean", true);
+    goap_cond_t start, goal;
+    if (!goap_domain_compile_query(&domain, currentState, goalState, &start, &goal)) {
+        fprintf(stderr, "Goal can never be reached in this domain\n");
+        return EXIT_FAILURE;
+    }
+    printf("Loaded %u actions and %u variables from %s (limits: %d actions, %d variables, %d nodes)\n",
+           domain.numActions, domain.numVars, path, GOAP_MAX_ACTIONS, GOAP_MAX_VARS, GOAP_MAX_NODES);
+    fflush(stdout);
+
+    const goap_search_t strategies[] = {GOAP_SEARCH_UNIFORM_COST, GOAP_SEARCH_ASTAR, GOAP_SEARCH_WEIGHTED_ASTAR,
+                                        GOAP_SEARCH_GREEDY, GOAP_SEARCH_IDASTAR};
+    const char *names[] = {"uniform cost", "A*", "weighted A*", "greedy", "IDA*"};
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        goap_planner_options_t options = {0};
+        options.search = strategies[i];
+        options.heuristic = GOAP_HEURISTIC_MAX;
+        options.weight = 2.0f;
+        goap_plan_stats_t stats;
+        uint32_t plan[64];
+        size_t length = 0;
+
+        armed = true;
+        goap_plan_status_t status = goap_domain_plan(&domain, start, goal, &options, &stats, plan, 64, &length);
+        armed = false;
+
+        printf("%s: status %d, %zu actions, cost %u, %u nodes visited\n", names[i], status, length, stats.planCost,
+               stats.nodesVisited);
+    }
+    puts("No heap calls were made while planning");
+
+    map_deinit(&currentState);
+    map_deinit(&goalState);
+    goap_domain_free(&domain);
+    goap_actionlist_free(&actions);
+    free(jsonStr);
+    return EXIT_SUCCESS;
+}